@@ -0,0 +1,250 @@
+#include <benchmark.h>
+#include <S1D13781/PixelConvert.h>
+#include <Platform/Timers.h>
+
+namespace
+{
+using namespace S1D13781;
+
+/*
+ * Line cropping as originally implemented in Gfx, retained here for comparison
+ */
+namespace Legacy
+{
+#define seSameSigns(A, B) (((A) >= 0) ^ ((B) < 0))
+
+enum IntersectType {
+	noIntersect,
+	collinear,
+	intersect,
+};
+
+IntersectType getIntersectionPoint(int AX1, int AY1, int AX2, int AY2, int BX1, int BY1, int BX2, int BY2,
+								   int* intersectX, int* intersectY)
+{
+	long a1, a2, b1, b2, c1, c2; // Coefficients of line eqns.
+	long r1, r2, r3, r4;		 // 'Sign' values
+	long denom, offset, num;	 // Intermediate values
+
+	a1 = AY2 - AY1;
+	b1 = AX1 - AX2;
+	c1 = AX2 * AY1 - AX1 * AY2;
+
+	r3 = a1 * BX1 + b1 * BY1 + c1;
+	r4 = a1 * BX2 + b1 * BY2 + c1;
+
+	if(r3 != 0 && r4 != 0 && seSameSigns(r3, r4))
+		return noIntersect;
+
+	a2 = BY2 - BY1;
+	b2 = BX1 - BX2;
+	c2 = BX2 * BY1 - BX1 * BY2;
+
+	r1 = a2 * AX1 + b2 * AY1 + c2;
+	r2 = a2 * AX2 + b2 * AY2 + c2;
+
+	if(r1 != 0 && r2 != 0 && seSameSigns(r1, r2))
+		return noIntersect;
+
+	denom = a1 * b2 - a2 * b1;
+	if(denom == 0)
+		return collinear;
+
+	offset = (denom < 0) ? -denom / 2 : denom / 2;
+
+	num = b1 * c2 - b2 * c1;
+	*intersectX = (num < 0 ? num - offset : num + offset) / denom;
+
+	num = a2 * c1 - a1 * c2;
+	*intersectY = (num < 0 ? num - offset : num + offset) / denom;
+
+	return intersect;
+}
+
+bool cropLine(int* X1, int* Y1, int* X2, int* Y2, int cropRegionX, int cropRegionY, int cropRegionWidth,
+			  int cropRegionHeight)
+{
+	bool lineCropped = false;
+	int RX1 = cropRegionX;
+	int RY1 = cropRegionY;
+	int RX2 = cropRegionX + cropRegionWidth - 1;
+	int RY2 = cropRegionY + cropRegionHeight - 1;
+	int ix = 0;
+	int iy = 0;
+
+	if(getIntersectionPoint(*X1, *Y1, *X2, *Y2, RX1, RY1, RX2, RY1, &ix, &iy) == intersect) {
+		if(*Y1 <= RY1) {
+			*X1 = ix;
+			*Y1 = iy;
+		} else {
+			*X2 = ix;
+			*Y2 = iy;
+		}
+		lineCropped = true;
+	}
+
+	if(getIntersectionPoint(*X1, *Y1, *X2, *Y2, RX1, RY2, RX2, RY2, &ix, &iy) == intersect) {
+		if(*Y1 >= RY2) {
+			*X1 = ix;
+			*Y1 = iy;
+		} else {
+			*X2 = ix;
+			*Y2 = iy;
+		}
+		lineCropped = true;
+	}
+
+	if(getIntersectionPoint(*X1, *Y1, *X2, *Y2, RX1, RY1, RX1, RY2, &ix, &iy) == intersect) {
+		if(*X1 <= RX1) {
+			*X1 = ix;
+			*Y1 = iy;
+		} else {
+			*X2 = ix;
+			*Y2 = iy;
+		}
+		lineCropped = true;
+	}
+
+	if(getIntersectionPoint(*X1, *Y1, *X2, *Y2, RX2, RY1, RX2, RY2, &ix, &iy) == intersect) {
+		if(*X1 >= RX2) {
+			*X1 = ix;
+			*Y1 = iy;
+		} else {
+			*X2 = ix;
+			*Y2 = iy;
+		}
+		lineCropped = true;
+	}
+
+	return lineCropped;
+}
+
+} // namespace Legacy
+
+struct Line {
+	int x1;
+	int y1;
+	int x2;
+	int y2;
+};
+
+int randomCoord(int size)
+{
+	// Extend range so that about half the lines need clipping
+	return int(os_random() % (2 * size)) - size / 2;
+}
+
+} // namespace
+
+namespace Benchmark
+{
+void lineClip(Gfx& gfx, Window window)
+{
+	constexpr unsigned lineCount = 256;
+	constexpr unsigned repeatCount = 8;
+
+	SeRect clip(gfx.getWindowSize(window));
+	auto lines = new Line[lineCount];
+	if(lines == nullptr) {
+		return;
+	}
+	for(unsigned i = 0; i < lineCount; ++i) {
+		auto& ln = lines[i];
+		ln = Line{randomCoord(clip.width), randomCoord(clip.height), randomCoord(clip.width),
+				  randomCoord(clip.height)};
+	}
+
+	// Legacy method doesn't reject lines, so count those with an end point still outside
+	unsigned legacyOutside = 0;
+	auto startTime = micros();
+	for(unsigned r = 0; r < repeatCount; ++r) {
+		legacyOutside = 0;
+		for(unsigned i = 0; i < lineCount; ++i) {
+			auto ln = lines[i];
+			Legacy::cropLine(&ln.x1, &ln.y1, &ln.x2, &ln.y2, clip.x, clip.y, clip.width, clip.height);
+			if(!clip.contains(SeRect(ln.x1, ln.y1, 1, 1)) || !clip.contains(SeRect(ln.x2, ln.y2, 1, 1))) {
+				++legacyOutside;
+			}
+		}
+	}
+	unsigned legacyTime = micros() - startTime;
+
+	unsigned rejected = 0;
+	startTime = micros();
+	for(unsigned r = 0; r < repeatCount; ++r) {
+		rejected = 0;
+		for(unsigned i = 0; i < lineCount; ++i) {
+			auto ln = lines[i];
+			if(!clipLine(ln.x1, ln.y1, ln.x2, ln.y2, clip)) {
+				++rejected;
+			}
+		}
+	}
+	unsigned clipTime = micros() - startTime;
+
+	delete[] lines;
+
+	unsigned total = lineCount * repeatCount;
+	debug_i("Line clipping, %u lines:", total);
+	debug_i("  _cropLine: %u us (%u ns/line), %u lines left partly outside", legacyTime,
+			unsigned(1000ULL * legacyTime / total), legacyOutside);
+	debug_i("  clipLine:  %u us (%u ns/line), %u lines rejected", clipTime, unsigned(1000ULL * clipTime / total),
+			rejected);
+}
+
+void pixelConvert()
+{
+	constexpr unsigned pixelCount = 1024;
+	constexpr unsigned repeatCount = 16;
+	const ImageDataFormat formats[]{format_RGB_888, format_RGB_565, format_RGB_332LUT};
+
+	auto src = new uint32_t[pixelCount * 3 / 4];
+	auto dst = new uint8_t[pixelCount * 3];
+	if(src == nullptr || dst == nullptr) {
+		delete[] src;
+		delete[] dst;
+		return;
+	}
+	for(unsigned i = 0; i < pixelCount * 3 / 4; ++i) {
+		src[i] = os_random();
+	}
+
+	unsigned total = pixelCount * repeatCount;
+	debug_i("Pixel conversion, %u pixels:", total);
+	for(auto srcFormat : formats) {
+		for(auto dstFormat : formats) {
+			if(srcFormat == dstFormat) {
+				continue;
+			}
+
+			// Per-pixel conversion via RGBColor, as previously used
+			unsigned srcBytes = getBytesPerPixel(srcFormat);
+			unsigned dstBytes = getBytesPerPixel(dstFormat);
+			auto srcData = reinterpret_cast<const uint8_t*>(src);
+			auto startTime = micros();
+			for(unsigned r = 0; r < repeatCount; ++r) {
+				for(unsigned i = 0; i < pixelCount; ++i) {
+					auto in = &srcData[i * srcBytes];
+					SeColor color(in[0] | (in[1] << 8) | (in[2] << 16), srcFormat);
+					auto code = RGBColor(color).getColor(dstFormat).code;
+					memcpy(&dst[i * dstBytes], &code, dstBytes);
+				}
+			}
+			unsigned pixelTime = micros() - startTime;
+
+			startTime = micros();
+			for(unsigned r = 0; r < repeatCount; ++r) {
+				convertPixels(dst, dstFormat, src, srcFormat, pixelCount);
+			}
+			unsigned bulkTime = micros() - startTime;
+
+			debug_i("  %u -> %u: per-pixel %u us, convertPixels %u us (%u KB/s output)", srcFormat, dstFormat,
+					pixelTime, bulkTime, bulkTime ? unsigned(1000ULL * total * dstBytes / bulkTime) : 0);
+		}
+	}
+
+	delete[] src;
+	delete[] dst;
+}
+
+} // namespace Benchmark
@@ -24,12 +24,14 @@
 #include <SeDisplay.h>
 #include <Data/CStringArray.h>
 #include <MemCheckState.h>
+#include <benchmark.h>
 
 //#define ENABLE_PIP
 
 // Raw image data
 IMPORT_FSTR(epsonImage, PROJECT_DIR "/files/epson_image.bin")
-IMPORT_FSTR(smingLogo, PROJECT_DIR "/files/sming_logo.raw")
+// Created from sming_logo.raw using: tools/mkimage.py --format rgb332 --rle --size 320x320
+IMPORT_FSTR(smingLogo, PROJECT_DIR "/files/sming_logo.img")
 
 extern HSPI::Controller spi;
 
@@ -249,7 +251,11 @@ void DisplayDemo::demoLoop()
 		unsigned x = (mainSize.width - imageWidth) / 2;
 		unsigned y = 10;
 		debug_i("drawImage(%u, %u, %u, %u)", x, y, imageWidth, imageHeight);
+		gfx.clearImageStats();
 		gfx.drawImage(epsonImage, Window::main, x, y, imageWidth, imageHeight);
+		auto& imageStats = gfx.getImageStats();
+		debug_i("drawImage: %u bytes in %u us, %u KB/s, %u%% of SPI clock", imageStats.bytes, imageStats.time,
+				imageStats.getRate(), imageStats.getEfficiency());
 		y += imageHeight + 10;
 
 		//now draw some text about the library using drawText()
@@ -684,6 +690,10 @@ void DisplayDemo::printDisplayConfig()
 
 	debug_i("Bytes per pixel = %u, stride = %u", gfx.getBytesPerPixel(Window::main), gfx.getStride(Window::main));
 
+	auto vram = gfx.getVram().getStats();
+	debug_i("VRAM used = %u, free = %u, largest free = %u, fragmentation = %u%%", vram.used, vram.free,
+			vram.largestFree, vram.fragmentation());
+
 #undef param
 }
 
@@ -1129,7 +1139,12 @@ void DisplayDemo::drawLogo()
 	unsigned imageHeight = 320;
 	unsigned x = (mainSize.width - imageWidth) / 2;
 	unsigned y = (mainSize.height - imageHeight) / 4;
-	gfx.drawImage(smingLogo, Window::main, x, y, imageWidth, imageHeight);
+	// Pre-converted to the window format so needs no conversion
+	gfx.clearImageStats();
+	gfx.drawImage(smingLogo, Window::main, x, y);
+	auto& imageStats = gfx.getImageStats();
+	debug_i("Logo: %u%% of uncompressed size, %u bytes sent, %u bytes saved by fills", imageStats.getCompressionRatio(),
+			imageStats.bytes, imageStats.savedBytes);
 
 	y += imageHeight + y;
 	SeFont font;
@@ -1143,6 +1158,9 @@ void DisplayDemo::start()
 {
 	printDisplayConfig();
 
+	Benchmark::lineClip(gfx, Window::main);
+	Benchmark::pixelConvert();
+
 	lcdMemCheck1();
 
 	debug_i("Checking LCD memory...");
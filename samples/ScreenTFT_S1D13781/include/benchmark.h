@@ -0,0 +1,20 @@
+#pragma once
+
+#include <S1D13781/Gfx.h>
+
+/*
+ * Timing of library internals, results are reported via debug output
+ */
+namespace Benchmark
+{
+/**
+ * @brief Compare integer line clipping with the original line intersection method
+ */
+void lineClip(S1D13781::Gfx& gfx, S1D13781::Window window);
+
+/**
+ * @brief Measure convertPixels() throughput for each pair of formats, compared with per-pixel conversion
+ */
+void pixelConvert();
+
+} // namespace Benchmark
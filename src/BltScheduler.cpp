@@ -0,0 +1,82 @@
+/*
+ * BltScheduler.cpp
+ *
+ */
+
+#include "include/S1D13781/BltScheduler.h"
+#include <Clock.h>
+
+namespace S1D13781
+{
+uint32_t BltScheduler::estimate(const SeBltParam& blt) const
+{
+	unsigned bytesPerPixel = ((blt.ctrl1 >> 2) & 0x03) + 1;
+	uint32_t pixels = uint32_t(blt.width) * blt.height;
+	uint32_t bytes = pixels * bytesPerPixel;
+
+	uint32_t cycles;
+	switch(blt.cmd) {
+	case BltCmd::movePositive:
+	case BltCmd::moveNegative:
+		cycles = bytes * model.moveCost;
+		break;
+	case BltCmd::moveExpand:
+		// Destination writes plus 1 bit per pixel of source reads
+		cycles = (bytes + (pixels / 8)) * model.expandCost;
+		break;
+	case BltCmd::solidFill:
+	default:
+		cycles = bytes * model.fillCost;
+	}
+
+	cycles = (cycles / 16) + model.overheadCycles;
+	return cycles / mclkMHz;
+}
+
+void BltScheduler::started(const SeBltParam& blt)
+{
+	++stats.count;
+	predicted = estimate(blt);
+	startTime = micros();
+	active = true;
+	wasBusy = false;
+}
+
+uint32_t BltScheduler::getRemaining() const
+{
+	if(!active) {
+		return 0;
+	}
+	uint32_t elapsed = micros() - startTime;
+	return (elapsed >= predicted) ? 0 : predicted - elapsed;
+}
+
+void BltScheduler::polled(bool busy)
+{
+	++stats.polls;
+	if(!active) {
+		return;
+	}
+
+	if(busy) {
+		wasBusy = true;
+		return;
+	}
+
+	active = false;
+
+	// Without calibration an idle engine on the first poll tells us only that the estimate was long enough
+	if(!wasBusy && !calibrate) {
+		return;
+	}
+
+	uint32_t elapsed = micros() - startTime;
+	++stats.measured;
+	stats.predictedTime += predicted;
+	stats.actualTime += elapsed;
+	if(elapsed > predicted) {
+		++stats.underestimates;
+	}
+}
+
+} // namespace S1D13781
@@ -0,0 +1,92 @@
+/*
+ * DamageTracker.cpp
+ *
+ */
+
+#include "include/S1D13781/DamageTracker.h"
+
+namespace S1D13781
+{
+bool DamageTracker::canMerge(const SeRect& r1, const SeRect& r2) const
+{
+	uint32_t merged = r1.united(r2).area();
+	return merged * 100 <= (r1.area() + r2.area()) * (100U + threshold);
+}
+
+void DamageTracker::remove(unsigned index)
+{
+	--rectCount;
+	rects[index] = rects[rectCount];
+}
+
+void DamageTracker::add(SeRect rect)
+{
+	if(!rect.intersect(bounds)) {
+		return;
+	}
+
+	++stats.reported;
+
+	// Consecutive operations (e.g. pixels of a line) usually fall within the same area
+	if(lastIndex < rectCount && rects[lastIndex].contains(rect)) {
+		return;
+	}
+
+	// Keep merging until no more candidates
+	bool merged;
+	do {
+		merged = false;
+		for(unsigned i = 0; i < rectCount; ++i) {
+			auto& r = rects[i];
+			if(r.contains(rect)) {
+				lastIndex = i;
+				return;
+			}
+			if(rect.contains(r) || canMerge(rect, r)) {
+				rect = rect.united(r);
+				remove(i);
+				++stats.merged;
+				merged = true;
+				break;
+			}
+		}
+	} while(merged);
+
+	if(rectCount == maxRects) {
+		// Combine with whichever entry grows the least
+		unsigned best = 0;
+		uint32_t bestGrowth = UINT32_MAX;
+		for(unsigned i = 0; i < rectCount; ++i) {
+			uint32_t growth = rect.united(rects[i]).area() - rects[i].area();
+			if(growth < bestGrowth) {
+				best = i;
+				bestGrowth = growth;
+			}
+		}
+		rect = rect.united(rects[best]);
+		remove(best);
+		++stats.merged;
+	}
+
+	lastIndex = rectCount;
+	rects[rectCount++] = rect;
+}
+
+uint32_t DamageTracker::area() const
+{
+	uint32_t total = 0;
+	for(auto& r : *this) {
+		total += r.area();
+	}
+	return total;
+}
+
+void DamageTracker::clear(uint8_t bytesPerPixel)
+{
+	++stats.frames;
+	stats.damagedBytes += area() * bytesPerPixel;
+	stats.fullBytes += bounds.area() * bytesPerPixel;
+	rectCount = 0;
+}
+
+} // namespace S1D13781
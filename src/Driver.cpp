@@ -27,9 +27,12 @@
 #include "include/S1D13781/Driver.h"
 #include "include/S1D13781/registers.h"
 #include "init.h"
+#include "PixelBuffer.h"
 #include <Digital.h>
 #include <Clock.h>
 #include <Platform/Timers.h>
+#include <Platform/System.h>
+#include <algorithm>
 
 namespace S1D13781
 {
@@ -45,17 +48,27 @@ const uint8_t SPIREAD_16BIT = 0xC8;
 #define CACHE_ENABLE
 
 /*
- * Mechanism for optimising cacheable register accesses.
- * We only cache certain register values.
+ * Shadow register file covering the entire register space, REG00 - REGD4.
+ *
+ * Only registers listed here are shadowed: these are stable, writable and have no side-effects.
+ * Status, trigger and BLT registers always go direct to the hardware.
+ * Writes between beginUpdate() and endUpdate() are deferred and flushed in contiguous bursts.
  */
-#define CACHED_REGISTERS(XX)                                                                                           \
+#define SHADOW_REGISTERS(XX)                                                                                           \
+	XX(REG04_POWER_SAVE)                                                                                               \
 	XX(REG12_PLL_1)                                                                                                    \
 	XX(REG14_PLL_2)                                                                                                    \
 	XX(REG16_INTCLK)                                                                                                   \
+	XX(REG20_PANEL_SET)                                                                                                \
+	XX(REG22_DISP_SET)                                                                                                 \
 	XX(REG24_HDISP)                                                                                                    \
 	XX(REG26_HNDP)                                                                                                     \
 	XX(REG28_VDISP)                                                                                                    \
 	XX(REG2A_VNDP)                                                                                                     \
+	XX(REG2C_HSW)                                                                                                      \
+	XX(REG2E_HPS)                                                                                                      \
+	XX(REG30_VSW)                                                                                                      \
+	XX(REG32_VPS)                                                                                                      \
 	XX(REG40_MAIN_SET)                                                                                                 \
 	XX(REG42_MAIN_SADDR_0)                                                                                             \
 	XX(REG44_MAIN_SADDR_1)                                                                                             \
@@ -70,40 +83,53 @@ const uint8_t SPIREAD_16BIT = 0xC8;
 	XX(REG62_ALPHA)                                                                                                    \
 	XX(REG64_TRANS)                                                                                                    \
 	XX(REG66_KEY_0)                                                                                                    \
-	XX(REG68_KEY_1)
-
-#define CACHED_REG_MIN REG12_PLL_1
-#define CACHED_REG_MAX REG68_KEY_1
-
-#define CACHED_REG_COUNT (((CACHED_REG_MAX - CACHED_REG_MIN) / 2) + 1)
-
-#define CACHE_INDEX(reg) (((reg)-CACHED_REG_MIN) / 2)
-
-#pragma pack(1)
-// Register layout for BLT operations so we can use burst write
-struct __attribute__((packed)) SeBltParam {
-	uint16_t ctrl0;
-	uint16_t ctrl1;
-	uint16_t status;
-	BltCmd cmd;
-	uint32_t ssAddr;
-	uint32_t dsAddr;
-	uint16_t rectOffset;
-	uint16_t width;
-	uint16_t height;
-	uint32_t bgColor;
-	uint32_t fgColor;
+	XX(REG68_KEY_1)                                                                                                    \
+	XX(REGD0_GPIO_CONFIG)                                                                                              \
+	XX(REGD4_GPIO_PULLDOWN)
+
+#define SHADOW_REG_COUNT ((REGD4_GPIO_PULLDOWN / 2) + 1)
+#define SHADOW_INDEX(reg) ((reg) / 2)
+
+struct ShadowRegisters {
+	uint16_t values[SHADOW_REG_COUNT]; ///< Laid out exactly as hardware registers
+	uint32_t dirty[(SHADOW_REG_COUNT + 31) / 32];
+
+	void setDirty(uint8_t regIndex)
+	{
+		auto i = SHADOW_INDEX(regIndex);
+		dirty[i / 32] |= BIT(i % 32);
+	}
+
+	bool isDirty(unsigned i) const
+	{
+		return dirty[i / 32] & BIT(i % 32);
+	}
 };
-#pragma pack()
 
-Driver::Driver(HSPI::Controller& controller) : MemoryDevice(controller)
+static bool isShadowed(uint8_t regIndex)
+{
+#ifdef CACHE_ENABLE
+	switch(regIndex) {
+#define XX(reg) case reg:
+		SHADOW_REGISTERS(XX)
+#undef XX
+		return true;
+	default:
+		return false;
+	}
+#else
+	return false;
+#endif
+}
+
+Driver::Driver(HSPI::Controller& controller) : MemoryDevice(controller), vram(*this)
 {
-	cache = new uint16_t[CACHED_REG_COUNT];
+	shadow = new ShadowRegisters{};
 }
 
 Driver::~Driver()
 {
-	delete cache;
+	delete shadow;
 }
 
 bool Driver::begin(HSPI::PinSet pinSet, uint8_t chipSelect, uint32_t clockSpeed)
@@ -115,6 +141,7 @@ bool Driver::begin(HSPI::PinSet pinSet, uint8_t chipSelect, uint32_t clockSpeed)
 	setBitOrder(MSBFIRST);
 	setClockMode(HSPI::ClockMode::mode0);
 	setIoMode(HSPI::IoMode::SPIHD);
+	spiClock = clockSpeed;
 	return initRegs();
 }
 
@@ -134,12 +161,18 @@ void Driver::updateTiming()
 	uint16_t vndp = regReadCached(REG2A_VNDP);
 
 	timing.frameInterval = 1000UL * (hdisp + hndp) * (vdisp + vndp) / (timing.pclk / 1000UL);
+	timing.displayLines = vdisp;
+	timing.totalLines = vdisp + vndp;
+	timing.lineInterval = 1000ULL * timing.frameInterval / timing.totalLines;
+	rasterScheduler.setTiming(timing.lineInterval, timing.displayLines, timing.totalLines);
+
+	bltScheduler.setClock(timing.mclk);
 }
 
 bool Driver::initRegs()
 {
-	// Initialise cache
-	read(S1D13781_REG_BASE + CACHED_REG_MIN, cache, CACHED_REG_COUNT * 2);
+	// Initialise shadow registers
+	read(S1D13781_REG_BASE, shadow->values, sizeof(shadow->values));
 
 	for(auto setting : displaySettings) {
 		switch(setting.cmd) {
@@ -180,6 +213,14 @@ bool Driver::initRegs()
 	}
 
 	updateTiming();
+
+	// Display memory used by the windows as configured
+	vram.initialise(S1D13781_VRAM_SIZE);
+	auto& main = getSurface(Window::main);
+	vram.reserve(main.startAddress, main.stride * main.size.height);
+	auto& pip = getSurface(Window::pip);
+	vram.reserve(pip.startAddress, pip.stride * pip.size.height);
+
 	return true;
 }
 
@@ -239,57 +280,48 @@ void Driver::prepareRead(HSPI::Request& req, uint32_t address)
 void Driver::regWrite(uint8_t regIndex, uint16_t regValue)
 {
 	debug_reg("regWrite(0x%02x, 0x%04x)", regIndex, regValue);
-	writeWord(S1D13781_REG_BASE + regIndex, regValue, 2);
 
-#ifdef CACHE_ENABLE
-	switch(regIndex) {
-#define XX(reg)                                                                                                        \
-	case reg:                                                                                                          \
-		cache[CACHE_INDEX(reg)] = regValue;                                                                            \
-		break;
-		CACHED_REGISTERS(XX)
-#undef XX
-	default:; // Not cached
+	invalidateSurfaces(regIndex);
+
+	if(isShadowed(regIndex)) {
+		shadow->values[SHADOW_INDEX(regIndex)] = regValue;
+		if(updateLevel != 0) {
+			shadow->setDirty(regIndex);
+			return;
+		}
+	} else if(updateLevel != 0) {
+		// Preserve ordering of deferred writes
+		commit();
 	}
-#endif
+
+	writeWord(S1D13781_REG_BASE + regIndex, regValue, 2);
 }
 
 void Driver::regWrite32(uint8_t regIndex, uint32_t regValue)
 {
 	debug_reg("regWrite32(0x%02x, 0x%08x)", regIndex, regValue);
-	writeWord(S1D13781_REG_BASE + regIndex, regValue, 4);
 
-#ifdef CACHE_ENABLE
-	switch(regIndex) {
-#define XX(reg)                                                                                                        \
-	case reg:                                                                                                          \
-		cache[CACHE_INDEX(reg)] = regValue >> 16;                                                                      \
-		cache[CACHE_INDEX(reg) + 1] = regValue & 0xFFFF;                                                               \
-		break;
-		CACHED_REGISTERS(XX)
-#undef XX
-	default:; // Not cached
+	invalidateSurfaces(regIndex);
+	invalidateSurfaces(regIndex + 2);
+
+	if(isShadowed(regIndex) && isShadowed(regIndex + 2)) {
+		shadow->values[SHADOW_INDEX(regIndex)] = regValue & 0xFFFF;
+		shadow->values[SHADOW_INDEX(regIndex) + 1] = regValue >> 16;
+		if(updateLevel != 0) {
+			shadow->setDirty(regIndex);
+			shadow->setDirty(regIndex + 2);
+			return;
+		}
+	} else if(updateLevel != 0) {
+		commit();
 	}
-#endif
+
+	writeWord(S1D13781_REG_BASE + regIndex, regValue, 4);
 }
 
 uint16_t Driver::regReadCached(uint8_t regIndex)
 {
-	uint16_t value;
-#ifdef CACHE_ENABLE
-	switch(regIndex) {
-#define XX(reg)                                                                                                        \
-	case reg:                                                                                                          \
-		value = cache[CACHE_INDEX(reg)];                                                                               \
-		break;
-		CACHED_REGISTERS(XX)
-#undef XX
-	default:
-#else
-	{
-#endif
-		value = regRead(regIndex);
-	}
+	uint16_t value = isShadowed(regIndex) ? shadow->values[SHADOW_INDEX(regIndex)] : regRead(regIndex);
 	debug_reg("regReadCached(0x%02x) = 0x%04x", regIndex, value);
 	return value;
 }
@@ -297,24 +329,47 @@ uint16_t Driver::regReadCached(uint8_t regIndex)
 uint32_t Driver::regReadCached32(uint8_t regIndex)
 {
 	uint32_t value;
-#ifdef CACHE_ENABLE
-	switch(regIndex) {
-#define XX(reg)                                                                                                        \
-	case reg:                                                                                                          \
-		value = (cache[CACHE_INDEX(reg)] << 16) | cache[CACHE_INDEX(reg) + 1];                                         \
-		break;
-		CACHED_REGISTERS(XX)
-#undef XX
-	default:
-#else
-	{
-#endif
+	if(isShadowed(regIndex) && isShadowed(regIndex + 2)) {
+		auto i = SHADOW_INDEX(regIndex);
+		value = shadow->values[i] | (shadow->values[i + 1] << 16);
+	} else {
 		value = regRead32(regIndex);
 	}
 	debug_reg("regReadCached32(0x%02x) = 0x%08x", regIndex, value);
 	return value;
 }
 
+void Driver::endUpdate()
+{
+	if(updateLevel == 0) {
+		return;
+	}
+	if(--updateLevel == 0) {
+		commit();
+	}
+}
+
+void Driver::commit()
+{
+	unsigned i = 0;
+	while(i < SHADOW_REG_COUNT) {
+		if(!shadow->isDirty(i)) {
+			++i;
+			continue;
+		}
+
+		// Write contiguous run of dirty registers as a single burst
+		unsigned start = i;
+		do {
+			shadow->dirty[i / 32] &= ~BIT(i % 32);
+			++i;
+		} while(i < SHADOW_REG_COUNT && shadow->isDirty(i));
+
+		debug_reg("commit(0x%02x, %u)", start * 2, i - start);
+		write(S1D13781_REG_BASE + (start * 2), &shadow->values[start], (i - start) * 2);
+	}
+}
+
 /* =====================================================================
  * LCD/Main Layer Methods
  *
@@ -342,8 +397,7 @@ void Driver::setRotation(Window window, uint16_t rotationDegrees)
 
 uint16_t Driver::getRotation(Window window)
 {
-	auto reg = regSelect(window, REG40_MAIN_SET, REG50_PIP_SET);
-	return reg ? (regReadCached(reg) >> 3) * 90 : 0;
+	return getSurface(window).rotation;
 }
 
 void Driver::setColorDepth(Window window, ImageDataFormat colorDepth)
@@ -356,8 +410,7 @@ void Driver::setColorDepth(Window window, ImageDataFormat colorDepth)
 
 ImageDataFormat Driver::getColorDepth(Window window)
 {
-	auto reg = regSelect(window, REG40_MAIN_SET, REG50_PIP_SET);
-	return ImageDataFormat(regReadCached(reg) & 0x0007);
+	return getSurface(window).format;
 }
 
 void Driver::setStartAddress(Window window, uint32_t lcdStartAddress)
@@ -370,17 +423,7 @@ void Driver::setStartAddress(Window window, uint32_t lcdStartAddress)
 
 uint32_t Driver::getStartAddress(Window window)
 {
-	auto reg = regSelect(window, REG42_MAIN_SADDR_0, REG52_PIP_SADDR_0);
-	return reg ? regReadCached32(reg) : 0xFFFFFFFF;
-}
-
-uint32_t Driver::getAddress(Window window, uint16_t x, uint16_t y)
-{
-	uint32_t addr = getStartAddress(window);
-	if(int(addr) >= 0) {
-		addr += (y * getStride(window)) + (x * getBytesPerPixel(window));
-	}
-	return addr;
+	return getSurface(window).startAddress;
 }
 
 uint16_t Driver::getDisplayWidth()
@@ -404,18 +447,7 @@ void Driver::setWidth(Window window, uint16_t width)
 
 uint16_t Driver::getWidth(Window window)
 {
-	uint16_t width = 0;
-	if(window == Window::pip) {
-		width = regReadCached(REG56_PIP_WIDTH);
-	} else if(window == Window::main) {
-		auto rotation = getRotation(window);
-		if(rotation == 90 || rotation == 270) {
-			width = getDisplayHeight();
-		} else {
-			width = getDisplayWidth();
-		}
-	}
-	return width;
+	return getSurface(window).size.width;
 }
 
 void Driver::setHeight(Window window, uint16_t height)
@@ -428,43 +460,283 @@ void Driver::setHeight(Window window, uint16_t height)
 
 uint16_t Driver::getHeight(Window window)
 {
-	uint16_t height = 0;
-	if(window == Window::pip) {
-		height = regReadCached(REG58_PIP_HEIGHT);
-	} else if(window == Window::main) {
-		auto rotation = getRotation(window);
-		if(rotation == 90 || rotation == 270) {
-			height = getDisplayWidth();
-		} else {
-			height = getDisplayHeight();
-		}
-	}
-	return height;
+	return getSurface(window).size.height;
 }
 
 SeSize Driver::getWindowSize(Window window)
 {
+	return getSurface(window).size;
+}
+
+uint16_t Driver::getStride(Window window)
+{
+	return getSurface(window).stride;
+}
+
+/* =====================================================================
+ * Surface descriptors
+ *
+ * ===================================================================== 
+*/
+
+template <ImageDataFormat format> static SeColor convertColor(SeColor color)
+{
+	// Colours already in this layout are passed through as conversion via RGB is not lossless
+	if(getBytesPerPixel(color.getFormat()) == getBytesPerPixel(format)) {
+		return SeColor(color.code, format);
+	}
+	return RGBColor(color).getColor(format);
+}
+
+static Surface::ColorConverter getColorConverter(ImageDataFormat format)
+{
+	switch(format) {
+	case format_RGB_565:
+		return convertColor<format_RGB_565>;
+	case format_RGB_565LUT:
+		return convertColor<format_RGB_565LUT>;
+	case format_RGB_332LUT:
+		return convertColor<format_RGB_332LUT>;
+	case format_RGB_888LUT:
+		return convertColor<format_RGB_888LUT>;
+	case format_RGB_888:
+	default:
+		return convertColor<format_RGB_888>;
+	}
+}
+
+const Surface Driver::invalidSurface{
+	.startAddress = 0xFFFFFFFF,
+	.stride = 0,
+	.bytesPerPixel = 0,
+	.format = format_Invalid,
+	.rotation = 0,
+	.size = SeSize(),
+	.converter = convertColor<format_Invalid>,
+};
+
+void Driver::updateSurface(Window window)
+{
+	auto& surface = surfaces[unsigned(window)];
+
+	uint16_t set;
 	SeSize size;
-	if(window == Window::pip) {
-		size.val = regReadCached32(REG56_PIP_WIDTH);
-	} else if(window == Window::main) {
-		size.width = getDisplayWidth();
-		size.height = getDisplayHeight();
+	if(window == Window::main) {
+		set = regReadCached(REG40_MAIN_SET);
+		surface.startAddress = isDoubleBuffered() ? backPage : regReadCached32(REG42_MAIN_SADDR_0);
+		size = getDisplaySize();
 	} else {
-		return size;
+		set = regReadCached(REG50_PIP_SET);
+		surface.startAddress = regReadCached32(REG52_PIP_SADDR_0);
+		size.val = regReadCached32(REG56_PIP_WIDTH);
 	}
 
-	auto rotation = getRotation(window);
-	if(rotation == 90 || rotation == 270) {
+	surface.format = ImageDataFormat(set & 0x0007);
+	surface.bytesPerPixel = ::getBytesPerPixel(surface.format);
+	surface.rotation = ((set >> 3) & 0x03) * 90;
+	if(surface.rotation == 90 || surface.rotation == 270) {
 		seSwap(size.width, size.height);
 	}
+	surface.size = size;
+	surface.stride = size.width * surface.bytesPerPixel;
+	surface.converter = getColorConverter(surface.format);
 
-	return size;
+	surfaceValid |= BIT(unsigned(window));
 }
 
-uint16_t Driver::getStride(Window window)
+void Driver::invalidateSurfaces(uint8_t regIndex)
 {
-	return getWidth(window) * getBytesPerPixel(window);
+	switch(regIndex) {
+	case REG24_HDISP:
+	case REG28_VDISP:
+	case REG40_MAIN_SET:
+	case REG42_MAIN_SADDR_0:
+	case REG44_MAIN_SADDR_1:
+		surfaceValid &= ~BIT(unsigned(Window::main));
+		break;
+	case REG50_PIP_SET:
+	case REG52_PIP_SADDR_0:
+	case REG54_PIP_SADDR_1:
+	case REG56_PIP_WIDTH:
+	case REG58_PIP_HEIGHT:
+		surfaceValid &= ~BIT(unsigned(Window::pip));
+		break;
+	default:;
+	}
+}
+
+/* =====================================================================
+ * Page flipping
+ *
+ * ===================================================================== 
+*/
+
+uint16_t Driver::getScanLine()
+{
+	return regRead(REG34_LINE_COUNT) & 0x03FF;
+}
+
+bool Driver::waitVerticalNonDisplay()
+{
+	auto line = getScanLine();
+	if(line < timing.displayLines) {
+		// Sleep until shortly before the last visible line
+		uint32_t lines = timing.displayLines - line - 1;
+		delayMicroseconds(lines * timing.lineInterval / 1000U);
+	}
+
+	OneShotFastMs timer(1 + timing.frameInterval / 1000U);
+	do {
+		if(getScanLine() >= timing.displayLines) {
+			return true;
+		}
+	} while(!timer.expired());
+
+	return false;
+}
+
+void Driver::bltCopyPage(uint32_t srcAddr, uint32_t dstAddr)
+{
+	auto& surface = getSurface(Window::main);
+	SeBltParam blt{
+		.ctrl0 = 0x0080,
+		.ctrl1 = uint16_t(((surface.bytesPerPixel - 1) << 2) | 0x0001),
+		.status = 0,
+		.cmd = BltCmd::movePositive,
+		.ssAddr = srcAddr,
+		.dsAddr = dstAddr,
+		.rectOffset = surface.size.width,
+		.width = surface.size.width,
+		.height = surface.size.height,
+		.bgColor = 0,
+		.fgColor = 0,
+	};
+	bltExecute(blt);
+}
+
+bool Driver::beginDoubleBuffer(bool copyFront)
+{
+	if(isDoubleBuffered()) {
+		return true;
+	}
+
+	auto& surface = getSurface(Window::main);
+	if(!surface.isValid()) {
+		return false;
+	}
+
+	auto addr = vram.alloc(uint32_t(surface.stride) * surface.size.height);
+	if(addr == VramHeap::invalid) {
+		debug_w("[S1D] Insufficient VRAM for double-buffering");
+		return false;
+	}
+
+	frontPage = surface.startAddress;
+	if(copyFront) {
+		bltCopyPage(frontPage, addr);
+	}
+	backPage = addr;
+	surfaceValid &= ~BIT(unsigned(Window::main));
+	return true;
+}
+
+void Driver::endDoubleBuffer()
+{
+	if(!isDoubleBuffered()) {
+		return;
+	}
+
+	// Wait for anything still drawing to the back page
+	flush();
+	bltWaitIdle(true);
+
+	vram.free(backPage);
+	backPage = VramHeap::invalid;
+	frontPage = VramHeap::invalid;
+	surfaceValid &= ~BIT(unsigned(Window::main));
+}
+
+bool Driver::flip(bool preserve)
+{
+	if(!isDoubleBuffered()) {
+		return false;
+	}
+
+	// Drawing must be complete before the page is shown
+	flush();
+	bltWaitIdle(true);
+
+	waitVerticalNonDisplay();
+	seSwap(frontPage, backPage);
+	regWrite32(REG42_MAIN_SADDR_0, frontPage);
+
+	if(preserve) {
+		bltCopyPage(frontPage, backPage);
+	}
+
+	return true;
+}
+
+/* =====================================================================
+ * Raster synchronisation
+ *
+ * ===================================================================== 
+*/
+
+void Driver::rasterWait(Window window, SePos pos, SeSize size, uint32_t duration)
+{
+	if(!rasterSync || size.width == 0 || size.height == 0) {
+		return;
+	}
+
+	// Back page isn't visible
+	if(window == Window::main && isDoubleBuffered()) {
+		return;
+	}
+
+	auto& surface = getSurface(window);
+	if(!surface.isValid()) {
+		return;
+	}
+
+	// Convert window area into range of display lines according to rotation
+	int first, last;
+	switch(surface.rotation) {
+	case 90:
+		first = surface.size.width - (pos.x + size.width);
+		last = surface.size.width - 1 - pos.x;
+		break;
+	case 180:
+		first = surface.size.height - (pos.y + size.height);
+		last = surface.size.height - 1 - pos.y;
+		break;
+	case 270:
+		first = pos.x;
+		last = pos.x + size.width - 1;
+		break;
+	default:
+		first = pos.y;
+		last = pos.y + size.height - 1;
+	}
+
+	if(window == Window::pip) {
+		int offset = regReadCached(REG5C_PIP_YSTART);
+		first += offset;
+		last += offset;
+	}
+
+	int maxLine = rasterScheduler.getDisplayLines() - 1;
+	first = std::max(first, 0);
+	last = std::min(last, maxLine);
+	if(first > last) {
+		return;
+	}
+
+	auto delay = rasterScheduler.getDelay(getScanLine(), first, last, duration);
+	rasterScheduler.checked(delay);
+	if(delay != 0) {
+		delayMicroseconds(delay);
+	}
 }
 
 /* =====================================================================
@@ -611,6 +883,9 @@ SeColor Driver::pipGetTransColor()
 
 void Driver::pipSetupWindow(uint16_t xPos, uint16_t yPos, uint16_t pipWidth, uint16_t pipHeight)
 {
+	// Size and position registers are contiguous so this becomes a single transfer
+	beginUpdate();
+
 	//write the width and height of the PIP window
 	SeSize pipSize = {pipWidth, pipHeight};
 	regWrite32(REG56_PIP_WIDTH, pipSize.val);
@@ -620,6 +895,17 @@ void Driver::pipSetupWindow(uint16_t xPos, uint16_t yPos, uint16_t pipWidth, uin
 	rotatePos(pos, pipSize, getRotation(Window::pip));
 
 	regWrite32(REG5A_PIP_XSTART, pos.val);
+
+	endUpdate();
+}
+
+void Driver::pipSetupFade(uint8_t fadeRate, uint8_t step, uint8_t ratio)
+{
+	beginUpdate();
+	pipSetFadeRate(fadeRate);
+	pipSetAlphaBlendStep(step);
+	pipSetAphaBlendRatio(ratio);
+	endUpdate();
 }
 
 /* =====================================================================
@@ -705,88 +991,463 @@ void Driver::setLutDefault(Window window)
 	}
 }
 
-#define bltExecute(blt)                                                                                                \
-	{                                                                                                                  \
-		regWaitForLow(REG84_BLT_STATUS, BIT(0), 1000);                                                                 \
-		write(S1D13781_REG_BASE + REG80_BLT_CTRL_0, &blt, sizeof(blt));                                                \
-		regWrite(REG80_BLT_CTRL_0, 0x0001);                                                                            \
+void Driver::bltExecute(const SeBltParam& blt, Window window, const SeBltParam* previous)
+{
+	// Queued operations must complete first
+	if(!queue.isEmpty()) {
+		flush();
+	}
+	bltWaitIdle(true);
+
+	if(rasterSync && window != Window::invalid) {
+		// Locate destination within window
+		auto& surface = getSurface(window);
+		uint32_t offset = blt.dsAddr - surface.startAddress;
+		SePos pos(offset % surface.stride / surface.bytesPerPixel, offset / surface.stride);
+		if(blt.cmd == BltCmd::moveNegative) {
+			// Address is of the last pixel
+			pos.x -= blt.width;
+			pos.y -= blt.height - 1;
+		}
+		rasterWait(window, pos, SeSize(blt.width, blt.height), bltScheduler.estimate(blt));
+	}
+	if(previous == nullptr) {
+		write(S1D13781_REG_BASE + REG80_BLT_CTRL_0, &blt, sizeof(blt));
+	} else {
+		// Send only the range of registers which have changed
+		auto cur = reinterpret_cast<const uint8_t*>(&blt);
+		auto prev = reinterpret_cast<const uint8_t*>(previous);
+		unsigned first = 0;
+		unsigned last = sizeof(blt);
+		while(first < last && cur[first] == prev[first]) {
+			++first;
+		}
+		while(last > first && cur[last - 1] == prev[last - 1]) {
+			--last;
+		}
+		// Registers are 16 bits
+		first &= ~1U;
+		last = (last + 1) & ~1U;
+		if(first < last) {
+			write(S1D13781_REG_BASE + REG80_BLT_CTRL_0 + first, &cur[first], last - first);
+		}
+	}
+	regWrite(REG80_BLT_CTRL_0, 0x0001);
+	bltScheduler.started(blt);
+
+	if(bltScheduler.isCalibrating()) {
+		bltWaitIdle(false);
 	}
+}
 
-bool Driver::bltSolidFill(Window window, SePos pos, SeSize size, SeColor color)
+bool Driver::bltWaitIdle(bool usePrediction)
 {
-	uint16_t bytesPerPixel = getBytesPerPixel(window);
-	if(bytesPerPixel == 0) {
+	// No need to poll the status register until the previous BLT is expected to have finished
+	if(usePrediction) {
+		auto remaining = bltScheduler.getRemaining();
+		if(remaining != 0) {
+			delayMicroseconds(remaining);
+		}
+	}
+
+	OneShotFastMs timer(1000);
+	do {
+		bool busy = regRead(REG84_BLT_STATUS) & BIT(0);
+		bltScheduler.polled(busy);
+		if(!busy) {
+			return true;
+		}
+	} while(!timer.expired());
+
+	return false;
+}
+
+bool Driver::bltPrepareSolidFill(SeBltParam& blt, Window window, SePos pos, SeSize size, SeColor color)
+{
+	auto& surface = getSurface(window);
+	if(!surface.isValid()) {
 		return false;
 	}
 
-	SeBltParam blt{
+	blt = SeBltParam{
 		.ctrl0 = 0x0080,
-		.ctrl1 = uint16_t((bytesPerPixel - 1) << 2),
+		.ctrl1 = uint16_t((surface.bytesPerPixel - 1) << 2),
 		.status = 0,
 		.cmd = BltCmd::solidFill,
 		.ssAddr = 0,
-		.dsAddr = getAddress(window, pos),
-		.rectOffset = getWidth(window),
+		.dsAddr = surface.getAddress(pos),
+		.rectOffset = surface.size.width,
 		.width = size.width,
 		.height = size.height,
 		.bgColor = 0,
-		.fgColor = lookupColor(window, color),
+		.fgColor = surface.lookupColor(color),
 	};
 
-	bltExecute(blt);
-
 	return true;
 }
 
-bool Driver::bltMoveExpand(Window window, uint32_t srcAddr, SePos dstPos, SeSize dstSize, SeColor fgColor,
-						   SeColor bgColor)
+bool Driver::bltPrepareMoveExpand(SeBltParam& blt, Window window, uint32_t srcAddr, SePos dstPos, SeSize dstSize,
+								  SeColor fgColor, SeColor bgColor)
 {
-	uint8_t bytesPerPixel = getBytesPerPixel(window);
-	if(bytesPerPixel == 0) {
+	auto& surface = getSurface(window);
+	if(!surface.isValid()) {
 		return false;
 	}
 
-	SeBltParam blt{
+	blt = SeBltParam{
 		.ctrl0 = 0x0080,
-		.ctrl1 = uint16_t(((bytesPerPixel - 1) << 2) | 0x0001),
+		.ctrl1 = uint16_t(((surface.bytesPerPixel - 1) << 2) | 0x0001),
 		.status = 0,
 		.cmd = BltCmd::moveExpand,
 		.ssAddr = srcAddr,
-		.dsAddr = getAddress(window, dstPos),
-		.rectOffset = getWidth(window),
+		.dsAddr = surface.getAddress(dstPos),
+		.rectOffset = surface.size.width,
 		.width = dstSize.width,
 		.height = dstSize.height,
-		.bgColor = lookupColor(window, bgColor),
-		.fgColor = lookupColor(window, fgColor),
+		.bgColor = surface.lookupColor(bgColor),
+		.fgColor = surface.lookupColor(fgColor),
 	};
 
-	bltExecute(blt);
-
 	return true;
 }
 
-bool Driver::bltMove(Window window, BltCmd cmd, SePos srcPos, SePos dstPos, SeSize size)
+bool Driver::bltPrepareMove(SeBltParam& blt, Window window, BltCmd cmd, SePos srcPos, SePos dstPos, SeSize size)
 {
-	uint8_t bytesPerPixel = getBytesPerPixel(window);
-	if(bytesPerPixel == 0) {
+	auto& surface = getSurface(window);
+	if(!surface.isValid()) {
 		return false;
 	}
 
-	SeBltParam blt{
+	blt = SeBltParam{
 		.ctrl0 = 0x0080,
-		.ctrl1 = uint16_t(((bytesPerPixel - 1) << 2) | 0x0001),
+		.ctrl1 = uint16_t(((surface.bytesPerPixel - 1) << 2) | 0x0001),
 		.status = 0,
 		.cmd = cmd,
-		.ssAddr = getAddress(window, srcPos),
-		.dsAddr = getAddress(window, dstPos),
-		.rectOffset = getWidth(window),
+		.ssAddr = surface.getAddress(srcPos),
+		.dsAddr = surface.getAddress(dstPos),
+		.rectOffset = surface.size.width,
 		.width = size.width,
 		.height = size.height,
+		.bgColor = 0,
+		.fgColor = 0,
 	};
 
-	bltExecute(blt);
+	return true;
+}
+
+bool Driver::bltSolidFill(Window window, SePos pos, SeSize size, SeColor color)
+{
+	SeBltParam blt;
+	if(!bltPrepareSolidFill(blt, window, pos, size, color)) {
+		return false;
+	}
+
+	bltExecute(blt, window);
+
+	return true;
+}
+
+bool Driver::bltMoveExpand(Window window, uint32_t srcAddr, SePos dstPos, SeSize dstSize, SeColor fgColor,
+						   SeColor bgColor)
+{
+	SeBltParam blt;
+	if(!bltPrepareMoveExpand(blt, window, srcAddr, dstPos, dstSize, fgColor, bgColor)) {
+		return false;
+	}
+
+	bltExecute(blt, window);
+
+	return true;
+}
+
+bool Driver::bltMove(Window window, BltCmd cmd, SePos srcPos, SePos dstPos, SeSize size)
+{
+	SeBltParam blt;
+	if(!bltPrepareMove(blt, window, cmd, srcPos, dstPos, size)) {
+		return false;
+	}
+
+	bltExecute(blt, window);
+
+	return true;
+}
+
+/*
+ * Choose the order in which to move rows between surfaces with different strides,
+ * so that no source row is overwritten before it has been read.
+ * Top-down is safe if each destination row ends before the next source row starts,
+ * bottom-up if each destination row starts after the previous source row ends.
+ * Both are linear in the row number so need checking only at the first and last rows.
+ * Returns 1 for top-down, -1 for bottom-up or 0 if neither order is safe.
+ */
+static int getRowStep(int64_t srcAddr, int64_t srcStride, int64_t dstAddr, int64_t dstStride, int64_t rowSize,
+					  unsigned rowCount)
+{
+	int64_t last = rowCount - 1;
+
+	// Areas which don't overlap at all may be copied in any order
+	if(dstAddr >= srcAddr + last * srcStride + rowSize || srcAddr >= dstAddr + last * dstStride + rowSize) {
+		return 1;
+	}
+
+	auto topDownGap = [&](int64_t row) {
+		return srcAddr + (row + 1) * srcStride - (dstAddr + row * dstStride + rowSize);
+	};
+	if(rowCount < 2 || (topDownGap(0) >= 0 && topDownGap(last - 1) >= 0)) {
+		return 1;
+	}
+
+	auto bottomUpGap = [&](int64_t row) {
+		return dstAddr + row * dstStride - (srcAddr + (row - 1) * srcStride + rowSize);
+	};
+	if(bottomUpGap(1) >= 0 && bottomUpGap(last) >= 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+bool Driver::bltMove(Window srcWindow, SePos srcPos, Window dstWindow, SePos dstPos, SeSize size)
+{
+	auto& srcSurface = getSurface(srcWindow);
+	auto& dstSurface = getSurface(dstWindow);
+	if(!srcSurface.isValid() || srcSurface.bytesPerPixel != dstSurface.bytesPerPixel) {
+		return false;
+	}
+	if(size.width == 0 || size.height == 0) {
+		return true;
+	}
+
+	uint32_t srcAddr = srcSurface.getAddress(srcPos);
+	uint32_t dstAddr = dstSurface.getAddress(dstPos);
+
+	if(srcSurface.stride == dstSurface.stride) {
+		// Copy backwards if the destination starts within the source
+		uint32_t srcEnd = srcSurface.getAddress(srcPos.x + size.width, srcPos.y + size.height - 1);
+		bool negative = (dstAddr > srcAddr) && (dstAddr < srcEnd);
+		BltCmd cmd = negative ? BltCmd::moveNegative : BltCmd::movePositive;
+		SeBltParam blt;
+		bltPrepareMove(blt, dstWindow, cmd, dstPos, dstPos, size);
+		if(negative) {
+			// Addresses are of the last pixel
+			blt.ssAddr = srcEnd;
+			blt.dsAddr = dstSurface.getAddress(dstPos.x + size.width, dstPos.y + size.height - 1);
+		} else {
+			blt.ssAddr = srcAddr;
+		}
+		bltExecute(blt, dstWindow);
+		return true;
+	}
+
+	unsigned rowSize = size.width * srcSurface.bytesPerPixel;
+	int step = getRowStep(srcAddr, srcSurface.stride, dstAddr, dstSurface.stride, rowSize, size.height);
+	if(step == 0) {
+		// Any order of row moves would overwrite part of the source before it is read
+		return moveBuffered(srcWindow, srcPos, dstWindow, dstPos, size);
+	}
+
+	// One row at a time; only the addresses and direction change between operations
+	SeBltParam blt[2];
+	const SeBltParam* previous = nullptr;
+	unsigned current = 0;
+	for(unsigned i = 0; i < size.height; ++i) {
+		unsigned row = (step < 0) ? (size.height - 1 - i) : i;
+		uint32_t rowSrc = srcSurface.getAddress(srcPos.x, srcPos.y + row);
+		uint32_t rowDst = dstSurface.getAddress(dstPos.x, dstPos.y + row);
+		// Copy the row backwards if its destination starts within its source
+		bool negative = (rowDst > rowSrc) && (rowDst < rowSrc + rowSize);
+		auto& param = blt[current];
+		if(previous == nullptr) {
+			bltPrepareMove(param, dstWindow, BltCmd::movePositive, dstPos, dstPos, SeSize(size.width, 1));
+		} else {
+			param = *previous;
+		}
+		param.cmd = negative ? BltCmd::moveNegative : BltCmd::movePositive;
+		// Negative moves take the addresses of the last pixel
+		param.ssAddr = negative ? rowSrc + rowSize : rowSrc;
+		param.dsAddr = negative ? rowDst + rowSize : rowDst;
+		bltExecute(param, dstWindow, previous);
+		previous = &param;
+		current ^= 1;
+	}
+
+	return true;
+}
+
+bool Driver::moveBuffered(Window srcWindow, SePos srcPos, Window dstWindow, SePos dstPos, SeSize size)
+{
+	auto& srcSurface = getSurface(srcWindow);
+	auto& dstSurface = getSurface(dstWindow);
+
+	// The whole area is read before any of it is written
+	PixelBuffer buffer;
+	if(!buffer.initialise(size.width, size.height, srcSurface.format)) {
+		return false;
+	}
+
+	// Earlier operations may still be updating the source
+	if(!queue.isEmpty()) {
+		flush();
+	}
+	bltWaitIdle(true);
+
+	auto data = static_cast<uint8_t*>(buffer.getPtr());
+	unsigned rowSize = buffer.getStride();
+	for(unsigned y = 0; y < size.height; ++y) {
+		read(srcSurface.getAddress(srcPos.x, srcPos.y + y), &data[y * rowSize], rowSize);
+	}
+
+	rasterWait(dstWindow, dstPos, size, getTransferTime(buffer.getSize()));
+	for(unsigned y = 0; y < size.height; ++y) {
+		write(dstSurface.getAddress(dstPos.x, dstPos.y + y), &data[y * rowSize], rowSize);
+	}
 
 	return true;
 }
 
+/* =====================================================================
+ * Command queue
+ *
+ * Each command is executed as a chain of asynchronous SPI requests. Completion callbacks run in
+ * interrupt context so just schedule a task to issue the next request.
+ *
+ * ===================================================================== 
+*/
+
+Command& Driver::queueReserve()
+{
+	Command* cmd;
+	while((cmd = queue.reserve()) == nullptr) {
+		// Queue is full: make room
+		wait(reqQueue);
+		serviceQueue();
+	}
+	return *cmd;
+}
+
+Driver::Fence Driver::queueBlt(const SeBltParam& blt)
+{
+	auto& cmd = queueReserve();
+	cmd.kind = Command::Kind::blt;
+	cmd.blt = blt;
+	auto fence = queue.commit();
+	serviceQueue();
+	return fence;
+}
+
+Driver::Fence Driver::queueSolidFill(Window window, SePos pos, SeSize size, SeColor color)
+{
+	SeBltParam blt;
+	return bltPrepareSolidFill(blt, window, pos, size, color) ? queueBlt(blt) : 0;
+}
+
+Driver::Fence Driver::queueMoveExpand(Window window, uint32_t srcAddr, SePos dstPos, SeSize dstSize,
+									  SeColor fgColor, SeColor bgColor)
+{
+	SeBltParam blt;
+	return bltPrepareMoveExpand(blt, window, srcAddr, dstPos, dstSize, fgColor, bgColor) ? queueBlt(blt) : 0;
+}
+
+Driver::Fence Driver::queueMove(Window window, BltCmd cmd, SePos srcPos, SePos dstPos, SeSize size)
+{
+	SeBltParam blt;
+	return bltPrepareMove(blt, window, cmd, srcPos, dstPos, size) ? queueBlt(blt) : 0;
+}
+
+Driver::Fence Driver::queueWrite(uint32_t address, const void* data, uint16_t length)
+{
+	auto& cmd = queueReserve();
+	cmd.kind = Command::Kind::write;
+	cmd.address = address;
+	cmd.data = data;
+	cmd.length = length;
+	auto fence = queue.commit();
+	serviceQueue();
+	return fence;
+}
+
+void Driver::waitFence(Fence fence)
+{
+	while(!queue.isComplete(fence)) {
+		wait(reqQueue);
+		serviceQueue();
+	}
+}
+
+void Driver::queueTask(void* param)
+{
+	static_cast<Driver*>(param)->serviceQueue();
+}
+
+void Driver::queueDeferredTask(void* param)
+{
+	auto self = static_cast<Driver*>(param);
+	self->queueDeferred = false;
+	self->serviceQueue();
+}
+
+bool IRAM_ATTR Driver::queueRequestComplete(HSPI::Request& request)
+{
+	System.queueCallback(queueTask, request.param);
+	return true;
+}
+
+void Driver::serviceQueue()
+{
+	// Nothing to do until the current request has completed
+	while(!reqQueue.busy) {
+		auto cmd = queue.peek();
+		if(cmd == nullptr) {
+			queueState = QueueState::idle;
+			return;
+		}
+
+		switch(queueState) {
+		case QueueState::idle:
+			if(cmd->kind == Command::Kind::write) {
+				queueState = QueueState::write;
+				write(reqQueue, cmd->address, cmd->data, cmd->length, queueRequestComplete, this);
+				return;
+			}
+			if(bltScheduler.getRemaining() != 0) {
+				// Previous BLT not expected to have finished yet, come back later
+				if(!queueDeferred) {
+					queueDeferred = true;
+					System.queueCallback(queueDeferredTask, this);
+				}
+				return;
+			}
+			queueState = QueueState::bltPoll;
+			read(reqQueue, S1D13781_REG_BASE + REG84_BLT_STATUS, &queueValue, 2, queueRequestComplete, this);
+			return;
+
+		case QueueState::bltPoll: {
+			bool busy = queueValue & BIT(0);
+			bltScheduler.polled(busy);
+			if(busy) {
+				read(reqQueue, S1D13781_REG_BASE + REG84_BLT_STATUS, &queueValue, 2, queueRequestComplete, this);
+				return;
+			}
+			queueState = QueueState::bltParams;
+			write(reqQueue, S1D13781_REG_BASE + REG80_BLT_CTRL_0, &cmd->blt, sizeof(cmd->blt), queueRequestComplete,
+				  this);
+			return;
+		}
+
+		case QueueState::bltParams:
+			queueState = QueueState::bltStart;
+			queueValue = 0x0001;
+			write(reqQueue, S1D13781_REG_BASE + REG80_BLT_CTRL_0, &queueValue, 2, queueRequestComplete, this);
+			bltScheduler.started(cmd->blt);
+			return;
+
+		case QueueState::bltStart:
+		case QueueState::write:
+			queue.pop();
+			queueState = QueueState::idle;
+			break;
+		}
+	}
+}
+
 } // namespace S1D13781
@@ -18,14 +18,225 @@
 
 #include "include/S1D13781/Gfx.h"
 #include "include/S1D13781/registers.h"
+#include "include/S1D13781/PixelBatcher.h"
+#include "include/S1D13781/PixelConvert.h"
 #include "PixelBuffer.h"
 #include "BitBuffer.h"
 #include <stringutil.h>
-
-#define seSameSigns(A, B) (((A) >= 0) ^ ((B) < 0))
+#include <Clock.h>
 
 namespace S1D13781
 {
+namespace
+{
+/*
+ * Half-widths of the rows of an ellipse quadrant, from the centre row outwards.
+ * Rows are tested against radii increased by half a pixel, x²/(rx² + rx) + y²/(ry² + ry) <= 1,
+ * stepping x inwards as y increases so each call costs only a few integer operations.
+ */
+class EllipseQuadrant
+{
+public:
+	EllipseQuadrant(unsigned rx, unsigned ry) : a(int64_t(rx) * rx + rx), b(int64_t(ry) * ry + ry), x(rx)
+	{
+	}
+
+	/** @brief Get half-width of a row, which must not be less than in the previous call
+	 *  @retval int -1 if row lies outside the ellipse
+	 */
+	int getHalfWidth(unsigned y)
+	{
+		int64_t limit = a * b - int64_t(y) * y * a;
+		while(x >= 0 && int64_t(x) * x * b > limit) {
+			--x;
+		}
+		return x;
+	}
+
+private:
+	int64_t a;
+	int64_t b;
+	int x;
+};
+
+/*
+ * Colours of a linear gradient, interpolated in 8-bit RGB.
+ */
+class ColorRamp
+{
+public:
+	ColorRamp(SeColor from, SeColor to, unsigned steps) : from(from), to(to), last((steps > 1) ? steps - 1 : 1)
+	{
+	}
+
+	SeColor operator[](unsigned step) const
+	{
+		return RGBColor(interpolate(from.r, to.r, step), interpolate(from.g, to.g, step),
+						interpolate(from.b, to.b, step))
+			.value;
+	}
+
+private:
+	uint8_t interpolate(int a, int b, unsigned step) const
+	{
+		return a + (b - a) * int(step) / int(last);
+	}
+
+	RGBColor from;
+	RGBColor to;
+	unsigned last;
+};
+
+/*
+ * Sequential reads from flash through a small buffer.
+ */
+class FlashReader
+{
+public:
+	FlashReader(const FSTR::ObjectBase& object, uint32_t offset) : object(object), offset(offset)
+	{
+	}
+
+	bool read(void* data, unsigned count)
+	{
+		auto ptr = static_cast<uint8_t*>(data);
+		while(count != 0) {
+			if(pos == length) {
+				length = object.read(offset, buffer, sizeof(buffer));
+				offset += length;
+				pos = 0;
+				if(length == 0) {
+					return false;
+				}
+			}
+			unsigned n = std::min(count, length - pos);
+			memcpy(ptr, &buffer[pos], n);
+			pos += n;
+			ptr += n;
+			count -= n;
+			bytesRead += n;
+		}
+		return true;
+	}
+
+	uint32_t getBytesRead() const
+	{
+		return bytesRead;
+	}
+
+private:
+	const FSTR::ObjectBase& object;
+	uint32_t offset;
+	uint32_t bytesRead{0};
+	unsigned pos{0};
+	unsigned length{0};
+	uint8_t buffer[64];
+};
+
+/*
+ * Repeat each pixel of a row `scale` times to produce `width` output pixels.
+ * `skip` is the number of output pixels to omit from the start, as when the row is clipped.
+ */
+void scaleRow(uint8_t* dst, const uint8_t* src, unsigned bytesPerPixel, unsigned skip, unsigned width,
+			  unsigned scale)
+{
+	src += (skip / scale) * bytesPerPixel;
+	unsigned repeat = skip % scale;
+	for(unsigned i = 0; i < width; ++i) {
+		memcpy(dst, src, bytesPerPixel);
+		dst += bytesPerPixel;
+		if(++repeat == scale) {
+			repeat = 0;
+			src += bytesPerPixel;
+		}
+	}
+}
+
+/*
+ * Collects bands of a gradient and fills them in batches using Gfx::fillRects().
+ */
+class BandFiller
+{
+public:
+	BandFiller(Gfx& gfx, Window window) : gfx(gfx), window(window)
+	{
+	}
+
+	~BandFiller()
+	{
+		flush();
+	}
+
+	void add(const SeRect& rect, SeColor color)
+	{
+		if(count == ARRAY_SIZE(rects)) {
+			flush();
+		}
+		rects[count] = rect;
+		colors[count] = color;
+		++count;
+	}
+
+	void flush()
+	{
+		gfx.fillRects(window, rects, colors, count);
+		count = 0;
+	}
+
+private:
+	Gfx& gfx;
+	Window window;
+	SeRect rects[8];
+	SeColor colors[8];
+	unsigned count{0};
+};
+
+} // namespace
+
+/*
+ * Polygon edge, stepped down one scanline at a time
+ */
+struct Gfx::PolygonEdge {
+	int yStart;	///< First scanline crossed
+	int yEnd;	  ///< Scanline after the last one crossed
+	int x0;		   ///< Upper vertex
+	int y0;
+	int32_t x;	 ///< Intersection with centre of current scanline, 16.16 fixed point
+	int32_t slope; ///< Change in x per scanline, 16.16 fixed point
+
+	/** @brief Initialise edge
+	 *  @retval bool false if edge is horizontal, so can be ignored
+	 */
+	bool set(int x0, int y0, int x1, int y1)
+	{
+		if(y0 == y1) {
+			return false;
+		}
+		if(y0 > y1) {
+			seSwap(x0, x1);
+			seSwap(y0, y1);
+		}
+		this->x0 = x0;
+		this->y0 = y0;
+		yStart = y0;
+		yEnd = y1;
+		slope = (int64_t(x1 - x0) << 16) / (y1 - y0);
+		return true;
+	}
+
+	/** @brief Calculate intersection with the first scanline to be drawn */
+	void start(int y)
+	{
+		x = (int64_t(x0) << 16) + int64_t(2 * (y - y0) + 1) * slope / 2;
+	}
+
+	/** @brief Get first pixel whose centre lies at or to the right of the edge */
+	int getPixel() const
+	{
+		return (x + 0x7FFF) >> 16;
+	}
+};
+
 uint16_t Gfx::fillWindow(Window window, SeColor color)
 {
 	return drawFilledRect(window, 0, 0, getWidth(window), getHeight(window), color);
@@ -33,76 +244,96 @@ uint16_t Gfx::fillWindow(Window window, SeColor color)
 
 uint16_t Gfx::drawPixel(Window window, int x, int y, SeColor color, bool update_params)
 {
-	static uint32_t vramAddress;   //video memory address
-	static uint16_t stride;		   //number of bytes in line
-	static uint16_t bytesPerPixel; //number of bytes per pixel
-	static uint16_t width;		   //width of window (used for range checking)
-	static uint16_t height;		   //height of window (used for range checking)
+	(void)update_params; // Window parameters are always current via getSurface()
 
-	//only update the params if necessary, save a bunch of register reads
-	if(update_params) {
-		vramAddress = getStartAddress(window);
-		stride = getStride(window); //number of bytes in line
-		bytesPerPixel = getBytesPerPixel(window);
-		width = getWidth(window);
-		height = getHeight(window);
-	}
+	auto& surface = getSurface(window);
 
 	//check that pixel coordinate is valid
-	if((x >= width) || (y >= height)) {
+	if(!surface.contains(x, y)) {
 		return 2; //error coordinate out of window
 	}
 
-	if(bytesPerPixel == 0) {
+	if(!surface.isValid()) {
 		return 2; //error invalid window image format
 	}
 
-	//calculate the memory offset of the pixel
-	unsigned pixelOffset = vramAddress + (y * stride) + (x * bytesPerPixel);
+	if(clipDepth != 0 && !clipStack[clipDepth - 1].contains(x, y)) {
+		return 0;
+	}
 
 	//draw the pixel color according to image format
-	writeWord(pixelOffset, lookupColor(window, color), bytesPerPixel);
+	writeWord(surface.getAddress(x, y), surface.lookupColor(color), surface.bytesPerPixel);
+	_addDamage(window, SeRect(x, y, 1, 1));
 
 	return 0;
 }
 
 SeColor Gfx::getPixel(Window window, int x, int y)
 {
-	SeSize size = getWindowSize(window);
+	auto& surface = getSurface(window);
+
 	//check that pixel coordinate is valid
-	if((x >= size.width) || (y >= size.height)) {
+	if(!surface.contains(x, y)) {
 		return 0xFE000000; //error coordinate out of window
 	}
 
-	auto format = getColorDepth(window);
-	uint8_t bytesPerPixel = ::getBytesPerPixel(format);
-
 	//read the correct number of bytes based on the image format
-	if(bytesPerPixel == 0) {
+	if(!surface.isValid()) {
 		return 0xFD000000; //error invalid window image format
 	}
 
-	//calculate the memory offset of the pixel
-	unsigned pixelOffset = getStartAddress(window) + (y * getStride(window)) + (x * bytesPerPixel);
-
-	uint32_t value = readWord(pixelOffset, bytesPerPixel);
-	return SeColor(value, format);
+	uint32_t value = readWord(surface.getAddress(x, y), surface.bytesPerPixel);
+	return SeColor(value, surface.format);
 }
 
 uint16_t Gfx::drawLine(Window window, int x1, int y1, int x2, int y2, SeColor color)
 {
-	color = lookupColor(window, color);
+	auto& surface = getSurface(window);
+	if(!surface.isValid()) {
+		return 1; //error invalid window
+	}
+	color = surface.lookupColor(color);
 
-	uint16_t width = getWidth(window);
-	uint16_t height = getHeight(window);
+	// Thick lines may extend beyond the clip area by up to half their width
+	int offset = (lineWidth - 1) / 2;
+	SeRect clip = getClip(window);
+	if(clip.isEmpty()) {
+		return 0;
+	}
+	clip.x -= offset;
+	clip.y -= offset;
+	clip.width += lineWidth - 1;
+	clip.height += lineWidth - 1;
+	if(!clipLine(x1, y1, x2, y2, clip)) {
+		return 0;
+	}
 
-	_cropLine(&x1, &y1, &x2, &y2, 0, 0, width, height);
+	// Horizontal and vertical lines need only a single fill
+	if(x1 == x2 || y1 == y2) {
+		SeRect r(std::min(x1, x2), std::min(y1, y2), abs(x2 - x1) + 1, abs(y2 - y1) + 1);
+		if(y1 == y2) {
+			r.y -= offset;
+			r.height = lineWidth;
+		}
+		if(x1 == x2) {
+			r.x -= offset;
+			r.width = lineWidth;
+		}
+		return drawFilledRect(window, r, color);
+	}
+
+	if(lineWidth > 1) {
+		_drawThickLine(window, x1, y1, x2, y2, color);
+		return 0;
+	}
 
 	if(x1 > x2) {
 		seSwap(x1, x2);
 		seSwap(y1, y2);
 	}
 
+	_addDamage(window, SeRect(x1, std::min(y1, y2), x2 - x1 + 1, abs(y2 - y1) + 1));
+
 	int dx = x2 - x1;
 	if(dx < 0) {
 		dx = -dx;
@@ -113,6 +344,8 @@ uint16_t Gfx::drawLine(Window window, int x1, int y1, int x2, int y2, SeColor co
 		dy = -dy;
 	}
 
+	PixelBatcher batcher(*this, window);
+
 	if(dx > dy) {
 		if(x1 > x2) {
 			seSwap(x1, x2);
@@ -132,7 +365,7 @@ uint16_t Gfx::drawLine(Window window, int x1, int y1, int x2, int y2, SeColor co
 
 		int x = x1;
 		int y = y1;
-		drawPixel(window, x, y, color, true);
+		batcher.setPixel(x, y, color);
 
 		for(x = x1 + 1; x <= x2; x++) {
 			if(d >= 0) {
@@ -142,7 +375,7 @@ uint16_t Gfx::drawLine(Window window, int x1, int y1, int x2, int y2, SeColor co
 				d += Bincr;
 			}
 
-			drawPixel(window, x, y, color, false);
+			batcher.setPixel(x, y, color);
 		}
 	} else {
 		if(y1 > y2) {
@@ -163,7 +396,7 @@ uint16_t Gfx::drawLine(Window window, int x1, int y1, int x2, int y2, SeColor co
 
 		int x = x1;
 		int y = y1;
-		drawPixel(window, x, y, color, true);
+		batcher.setPixel(x, y, color);
 
 		for(y = y1 + 1; y <= y2; y++) {
 			if(d >= 0) {
@@ -172,57 +405,589 @@ uint16_t Gfx::drawLine(Window window, int x1, int y1, int x2, int y2, SeColor co
 			} else {
 				d += Bincr;
 			}
-			drawPixel(window, x, y, color, false);
+			batcher.setPixel(x, y, color);
 		}
 	}
 
 	return 0;
 }
 
+void Gfx::_drawThickLine(Window window, int x1, int y1, int x2, int y2, SeColor color)
+{
+	// Each run of the line is drawn as a fill, lineWidth pixels across
+	int offset = (lineWidth - 1) / 2;
+	int dx = abs(x2 - x1);
+	int dy = abs(y2 - y1);
+
+	if(dx >= dy) {
+		if(x1 > x2) {
+			seSwap(x1, x2);
+			seSwap(y1, y2);
+		}
+
+		int yincr = (y2 > y1) ? 1 : -1;
+		int d = 2 * dy - dx;
+		int Aincr = 2 * (dy - dx);
+		int Bincr = 2 * dy;
+
+		int runStart = x1;
+		int y = y1;
+		for(int x = x1 + 1; x <= x2; x++) {
+			if(d >= 0) {
+				drawFilledRect(window, SeRect(runStart, y - offset, x - runStart, lineWidth), color);
+				runStart = x;
+				y += yincr;
+				d += Aincr;
+			} else {
+				d += Bincr;
+			}
+		}
+		drawFilledRect(window, SeRect(runStart, y - offset, x2 + 1 - runStart, lineWidth), color);
+	} else {
+		if(y1 > y2) {
+			seSwap(x1, x2);
+			seSwap(y1, y2);
+		}
+
+		int xincr = (x2 > x1) ? 1 : -1;
+		int d = 2 * dx - dy;
+		int Aincr = 2 * (dx - dy);
+		int Bincr = 2 * dx;
+
+		int runStart = y1;
+		int x = x1;
+		for(int y = y1 + 1; y <= y2; y++) {
+			if(d >= 0) {
+				drawFilledRect(window, SeRect(x - offset, runStart, lineWidth, y - runStart), color);
+				runStart = y;
+				x += xincr;
+				d += Aincr;
+			} else {
+				d += Bincr;
+			}
+		}
+		drawFilledRect(window, SeRect(x - offset, runStart, lineWidth, y2 + 1 - runStart), color);
+	}
+}
+
+uint16_t Gfx::drawFilledRect(Window window, const SeRect& rect, SeColor color)
+{
+	if(!getSurface(window).isValid()) {
+		return 2; //error invalid window format
+	}
+
+	SeRect r = getClip(window);
+	if(!r.intersect(rect)) {
+		return 0;
+	}
+
+	_addDamage(window, r);
+	return bltSolidFill(window, r.getPos(), r.getSize(), color) ? 0 : 2;
+}
+
+bool Gfx::pushClip(const SeRect& rect)
+{
+	if(clipDepth == S1D13781_CLIP_DEPTH) {
+		debug_w("Clip stack full");
+		return false;
+	}
+
+	SeRect r = rect;
+	if(clipDepth != 0) {
+		r.intersect(clipStack[clipDepth - 1]);
+	}
+	clipStack[clipDepth++] = r;
+	return true;
+}
+
+void Gfx::popClip()
+{
+	if(clipDepth != 0) {
+		--clipDepth;
+	}
+}
+
+SeRect Gfx::getClip(Window window)
+{
+	SeRect r(getWindowSize(window));
+	if(clipDepth != 0) {
+		r.intersect(clipStack[clipDepth - 1]);
+	}
+	return r;
+}
+
 uint16_t Gfx::drawRect(Window window, int xStart, int yStart, int width, int height, SeColor color)
 {
-	//	uint16_t stride;		//number of bytes in line
-	//	uint16_t bytesPerPixel; //number of bytes per pixel
+	if(width <= 0 || height <= 0) {
+		return 0;
+	}
 
-	int x2 = xStart + width - 1;
-	int y2 = yStart + height - 1;
+	auto& surface = getSurface(window);
+	if(!surface.isValid()) {
+		return 1; //error invalid window
+	}
+	color = surface.lookupColor(color);
+
+	// Edges lie inside the rectangle; if they meet it's just a filled rectangle
+	int t = lineWidth;
+	if(2 * t >= width || 2 * t >= height) {
+		return drawFilledRect(window, SeRect(xStart, yStart, width, height), color);
+	}
+
+	const SeRect edges[]{
+		SeRect(xStart, yStart, width, t),
+		SeRect(xStart, yStart + height - t, width, t),
+		SeRect(xStart, yStart + t, t, height - 2 * t),
+		SeRect(xStart + width - t, yStart + t, t, height - 2 * t),
+	};
+	return fillRects(window, edges, ARRAY_SIZE(edges), color);
+}
 
-	color = lookupColor(window, color);
-	drawLine(window, xStart, yStart, x2, yStart, color);
-	drawLine(window, xStart, y2, x2, y2, color);
-	drawLine(window, xStart, yStart, xStart, y2, color);
-	drawLine(window, x2, yStart, x2, y2, color);
+uint16_t Gfx::_fillRects(Window window, const SeRect* rects, const SeColor* colors, unsigned count, SeColor color)
+{
+	auto& surface = getSurface(window);
+	if(!surface.isValid()) {
+		return 1; //error invalid window
+	}
+
+	if(rects == nullptr) {
+		return 0;
+	}
+
+	SeRect clip = getClip(window);
+	color = surface.lookupColor(color);
+
+	// Alternate between two parameter blocks so the previous one is available for comparison
+	SeBltParam blt[2];
+	const SeBltParam* previous = nullptr;
+	unsigned current = 0;
+	for(unsigned i = 0; i < count; ++i) {
+		SeRect r = clip;
+		if(!r.intersect(rects[i])) {
+			continue;
+		}
+
+		SeColor fillColor = (colors == nullptr) ? color : surface.lookupColor(colors[i]);
+		auto& param = blt[current];
+		if(previous == nullptr) {
+			bltPrepareSolidFill(param, window, r.getPos(), r.getSize(), fillColor);
+		} else {
+			param = *previous;
+			param.dsAddr = surface.getAddress(r.getPos());
+			param.width = r.width;
+			param.height = r.height;
+		}
+		// Already in the window format, so every block uses it as is
+		param.fgColor = fillColor;
+
+		_addDamage(window, r);
+		bltExecute(param, window, previous);
+		previous = &param;
+		current ^= 1;
+	}
 
 	return 0;
 }
 
+uint16_t Gfx::fillCircle(Window window, int x, int y, unsigned radius, SeColor color)
+{
+	return fillEllipse(window, x, y, radius, radius, color);
+}
+
+uint16_t Gfx::drawCircle(Window window, int x, int y, unsigned radius, SeColor color)
+{
+	return drawEllipse(window, x, y, radius, radius, color);
+}
+
+uint16_t Gfx::fillEllipse(Window window, int x, int y, unsigned rx, unsigned ry, SeColor color)
+{
+	return _drawRounded(window, SeRect(x - rx, y - ry, 2 * rx + 1, 2 * ry + 1), rx, ry, color, true);
+}
+
+uint16_t Gfx::drawEllipse(Window window, int x, int y, unsigned rx, unsigned ry, SeColor color)
+{
+	return _drawRounded(window, SeRect(x - rx, y - ry, 2 * rx + 1, 2 * ry + 1), rx, ry, color, false);
+}
+
+uint16_t Gfx::fillRoundRect(Window window, const SeRect& rect, unsigned radius, SeColor color)
+{
+	return _drawRounded(window, rect, radius, radius, color, true);
+}
+
+uint16_t Gfx::drawRoundRect(Window window, const SeRect& rect, unsigned radius, SeColor color)
+{
+	return _drawRounded(window, rect, radius, radius, color, false);
+}
+
+uint16_t Gfx::fillTriangle(Window window, int x1, int y1, int x2, int y2, int x3, int y3, SeColor color)
+{
+	PolygonEdge edges[3];
+	unsigned count = 0;
+	count += edges[count].set(x1, y1, x2, y2);
+	count += edges[count].set(x2, y2, x3, y3);
+	count += edges[count].set(x3, y3, x1, y1);
+	return _fillEdges(window, edges, count, color);
+}
+
+uint16_t Gfx::fillPolygon(Window window, const SePos* points, unsigned count, SeColor color)
+{
+	if(points == nullptr || count < 3) {
+		return 0;
+	}
+
+	PolygonEdge edgeBuffer[S1D13781_POLYGON_EDGES];
+	auto edges = (count <= ARRAY_SIZE(edgeBuffer)) ? edgeBuffer : new PolygonEdge[count];
+	if(edges == nullptr) {
+		return 2; // memory alloc failed
+	}
+
+	unsigned edgeCount = 0;
+	for(unsigned i = 0; i < count; ++i) {
+		auto& p1 = points[i];
+		auto& p2 = points[(i + 1) % count];
+		edgeCount += edges[edgeCount].set(p1.x, p1.y, p2.x, p2.y);
+	}
+
+	auto result = _fillEdges(window, edges, edgeCount, color);
+
+	if(edges != edgeBuffer) {
+		delete[] edges;
+	}
+
+	return result;
+}
+
+uint16_t Gfx::_fillEdges(Window window, PolygonEdge* edges, unsigned count, SeColor color)
+{
+	auto& surface = getSurface(window);
+	if(!surface.isValid()) {
+		return 1; //error invalid window
+	}
+
+	if(count < 2) {
+		return 0;
+	}
+
+	// Edge table, ordered by first scanline
+	int yEnd = edges[0].yEnd;
+	for(unsigned i = 1; i < count; ++i) {
+		auto edge = edges[i];
+		yEnd = std::max(yEnd, edge.yEnd);
+		unsigned j = i;
+		for(; j > 0 && edges[j - 1].yStart > edge.yStart; --j) {
+			edges[j] = edges[j - 1];
+		}
+		edges[j] = edge;
+	}
+
+	SeRect clip = getClip(window);
+	int y = std::max(edges[0].yStart, int(clip.y));
+	yEnd = std::min(yEnd, int(clip.y2()));
+	if(y >= yEnd) {
+		return 0;
+	}
+
+	PolygonEdge* activeBuffer[S1D13781_POLYGON_EDGES];
+	auto active = (count <= ARRAY_SIZE(activeBuffer)) ? activeBuffer : new PolygonEdge*[count];
+	if(active == nullptr) {
+		return 2; // memory alloc failed
+	}
+
+	color = surface.lookupColor(color);
+	PixelBatcher batcher(*this, window);
+
+	// Spans are held back while following scanlines continue them with the same extent
+	SeRect pending[S1D13781_POLYGON_SPANS];
+	unsigned pendingCount = 0;
+
+	unsigned activeCount = 0;
+	unsigned nextEdge = 0;
+	for(; y < yEnd; ++y) {
+		// Update active edge list
+		unsigned n = 0;
+		for(unsigned i = 0; i < activeCount; ++i) {
+			if(active[i]->yEnd > y) {
+				active[n++] = active[i];
+			}
+		}
+		activeCount = n;
+		for(; nextEdge < count && edges[nextEdge].yStart <= y; ++nextEdge) {
+			auto& edge = edges[nextEdge];
+			if(edge.yEnd > y) {
+				edge.start(y);
+				active[activeCount++] = &edge;
+			}
+		}
+
+		// Order by x; edges rarely cross so this is usually already sorted
+		for(unsigned i = 1; i < activeCount; ++i) {
+			auto edge = active[i];
+			unsigned j = i;
+			for(; j > 0 && active[j - 1]->x > edge->x; --j) {
+				active[j] = active[j - 1];
+			}
+			active[j] = edge;
+		}
+
+		// Pixels between alternate pairs of edges are inside (even-odd rule)
+		bool continued[S1D13781_POLYGON_SPANS]{};
+		SeRect added[S1D13781_POLYGON_SPANS];
+		unsigned addedCount = 0;
+		for(unsigned i = 0; i + 1 < activeCount; i += 2) {
+			int x1 = active[i]->getPixel();
+			int x2 = active[i + 1]->getPixel();
+			if(x2 <= x1) {
+				continue;
+			}
+
+			SeRect span(x1, y, x2 - x1, 1);
+			unsigned j = 0;
+			while(j < pendingCount && (continued[j] || pending[j].x != span.x || pending[j].width != span.width)) {
+				++j;
+			}
+			if(j < pendingCount) {
+				++pending[j].height;
+				continued[j] = true;
+			} else if(addedCount < ARRAY_SIZE(added)) {
+				added[addedCount++] = span;
+			} else {
+				_drawSpan(batcher, clip, window, span, color);
+			}
+		}
+
+		// Draw spans which have ended
+		n = 0;
+		for(unsigned i = 0; i < pendingCount; ++i) {
+			if(continued[i]) {
+				pending[n++] = pending[i];
+			} else {
+				_drawSpan(batcher, clip, window, pending[i], color);
+			}
+		}
+		pendingCount = n;
+		for(unsigned i = 0; i < addedCount; ++i) {
+			if(pendingCount < ARRAY_SIZE(pending)) {
+				pending[pendingCount++] = added[i];
+			} else {
+				_drawSpan(batcher, clip, window, added[i], color);
+			}
+		}
+
+		for(unsigned i = 0; i < activeCount; ++i) {
+			active[i]->x += active[i]->slope;
+		}
+	}
+
+	for(unsigned i = 0; i < pendingCount; ++i) {
+		_drawSpan(batcher, clip, window, pending[i], color);
+	}
+
+	if(active != activeBuffer) {
+		delete[] active;
+	}
+
+	return 0;
+}
+
+uint16_t Gfx::_drawRounded(Window window, const SeRect& rect, unsigned rx, unsigned ry, SeColor color, bool filled)
+{
+	auto& surface = getSurface(window);
+	if(!surface.isValid()) {
+		return 1; //error invalid window
+	}
+
+	if(rect.isEmpty()) {
+		return 0;
+	}
+
+	SeRect clip = getClip(window);
+	if(!clip.overlap(rect)) {
+		return 0;
+	}
+
+	// Corners may not overlap
+	rx = std::min(rx, (rect.width - 1U) / 2U);
+	ry = std::min(ry, (rect.height - 1U) / 2U);
+
+	color = surface.lookupColor(color);
+	PixelBatcher batcher(*this, window);
+
+	// Row and column of corner centres
+	int top = rect.y + int(ry);
+	int bottom = rect.y2() - 1 - int(ry);
+	int left = rect.x + int(rx);
+	int right = rect.x2() - 1 - int(rx);
+
+	EllipseQuadrant quadrant(rx, ry);
+	int prevHalfWidth = quadrant.getHalfWidth(0);
+
+	if(filled) {
+		// Straight-sided middle section
+		_drawSpan(batcher, clip, window, SeRect(rect.x, top, rect.width, bottom - top + 1), color);
+
+		// Remaining rows shrink towards top and bottom; those of the same width are combined
+		unsigned runStart = 1;
+		int runHalfWidth = quadrant.getHalfWidth(1);
+		for(unsigned dy = 2; dy <= ry + 1; ++dy) {
+			int halfWidth = (dy <= ry) ? quadrant.getHalfWidth(dy) : -1;
+			if(halfWidth == runHalfWidth) {
+				continue;
+			}
+			// Emit symmetric spans together
+			SeRect span(left - runHalfWidth, top + 1 - int(dy), right - left + 1 + 2 * runHalfWidth, dy - runStart);
+			_drawSpan(batcher, clip, window, span, color);
+			span.y = bottom + int(runStart);
+			_drawSpan(batcher, clip, window, span, color);
+			runStart = dy;
+			runHalfWidth = halfWidth;
+		}
+
+		return 0;
+	}
+
+	/*
+	 * Outline. Each row covers the pixels from its own half-width out to the next row's,
+	 * so the curve has no gaps where it becomes steep.
+	 */
+
+	// Without a vertical radius there are no corner rows, just a rectangle outline
+	if(ry == 0) {
+		SeRect edge(rect.x, rect.y, rect.width, 1);
+		_drawSpan(batcher, clip, window, edge, color);
+		if(rect.height > 1) {
+			edge.y = rect.y2() - 1;
+			_drawSpan(batcher, clip, window, edge, color);
+		}
+		if(rect.height > 2) {
+			SeRect side(rect.x, rect.y + 1, 1, rect.height - 2);
+			_drawSpan(batcher, clip, window, side, color);
+			side.x = rect.x2() - 1;
+			_drawSpan(batcher, clip, window, side, color);
+		}
+		return 0;
+	}
+
+	// Straight sides, plus any extra pixels in the first rows of the corners
+	SeRect side(rect.x, top, 1, bottom - top + 1);
+	_drawSpan(batcher, clip, window, side, color);
+	side.x = rect.x2() - 1;
+	_drawSpan(batcher, clip, window, side, color);
+
+	int nextHalfWidth = quadrant.getHalfWidth(1);
+	if(nextHalfWidth + 1 < prevHalfWidth) {
+		SeRect span(right + nextHalfWidth + 1, top, prevHalfWidth - nextHalfWidth - 1, 1);
+		_drawSpan(batcher, clip, window, span, color);
+		span.x = left - prevHalfWidth + 1;
+		_drawSpan(batcher, clip, window, span, color);
+		if(bottom != top) {
+			span.y = bottom;
+			_drawSpan(batcher, clip, window, span, color);
+			span.x = right + nextHalfWidth + 1;
+			_drawSpan(batcher, clip, window, span, color);
+		}
+	}
+
+	// Corner rows, combining those which cover the same columns. The outermost row is joined across the shape.
+	const int joined = -1;
+	const int none = -2;
+	unsigned runStart = 1;
+	int runInner = none;
+	int runOuter = none;
+	for(unsigned dy = 1; dy <= ry + 1; ++dy) {
+		int inner = none;
+		int outer = none;
+		if(dy < ry) {
+			outer = nextHalfWidth;
+			nextHalfWidth = quadrant.getHalfWidth(dy + 1);
+			inner = std::min(nextHalfWidth + 1, outer);
+		} else if(dy == ry) {
+			outer = nextHalfWidth;
+			inner = joined;
+		}
+		if(inner == runInner && outer == runOuter) {
+			continue;
+		}
+
+		if(dy > 1) {
+			int height = dy - runStart;
+			int upper = top + 1 - int(dy);
+			int lower = bottom + int(runStart);
+			if(runInner == joined) {
+				SeRect span(left - runOuter, upper, right - left + 1 + 2 * runOuter, height);
+				_drawSpan(batcher, clip, window, span, color);
+				span.y = lower;
+				_drawSpan(batcher, clip, window, span, color);
+			} else {
+				SeRect span(right + runInner, upper, runOuter - runInner + 1, height);
+				_drawSpan(batcher, clip, window, span, color);
+				span.y = lower;
+				_drawSpan(batcher, clip, window, span, color);
+				span.x = left - runOuter;
+				_drawSpan(batcher, clip, window, span, color);
+				span.y = upper;
+				_drawSpan(batcher, clip, window, span, color);
+			}
+		}
+
+		runStart = dy;
+		runInner = inner;
+		runOuter = outer;
+	}
+
+	return 0;
+}
+
+void Gfx::_drawSpan(PixelBatcher& batcher, const SeRect& clip, Window window, SeRect span, SeColor color)
+{
+	if(!span.intersect(clip)) {
+		return;
+	}
+
+	// Small spans cost less as pixel writes than as a BLT
+	if(span.area() >= S1D13781_PIXEL_BATCH_FILL) {
+		batcher.flush();
+		drawFilledRect(window, span, color);
+		return;
+	}
+
+	_addDamage(window, span);
+	for(int y = span.y; y < span.y2(); ++y) {
+		for(int x = span.x; x < span.x2(); ++x) {
+			batcher.setPixel(x, y, color);
+		}
+	}
+}
+
 uint16_t Gfx::drawFilledRectSlow(Window window, const SeRect& rect, SeColor color)
 {
-	auto format = getColorDepth(window);
-	uint8_t bytesPerPixel = ::getBytesPerPixel(format);
-	if(bytesPerPixel == 0) {
+	auto& surface = getSurface(window);
+	if(!surface.isValid()) {
 		return 1; //error invalid window
 	}
 
 	// Display rect (the area of the given rect that exists on the surface)
-	SeRect r(getWindowSize(window));
+	SeRect r = getClip(window);
 	if(!r.intersect(rect)) {
-		return 1;
+		return 0;
 	}
 
 	//	debug_i("(%u, %u, %u, %u)", r.x, r.y, r.width, r.height);
 
 	PixelBuffer buffer;
-	if(!buffer.initialise(r.width, 1, format)) {
+	if(!buffer.initialise(r.width, 1, surface.format)) {
 		return 3;
 	}
 
 	// Create first line
-	buffer.fill(lookupColor(window, color));
+	buffer.fill(surface.lookupColor(color));
+
+	_addDamage(window, r);
+
+	rasterWait(window, r.getPos(), r.getSize(), getTransferTime(buffer.getSize() * r.height));
 
 	// Burst-write using the line buffer to the display
-	uint16_t stride = getStride(window);
-	uint32_t addr = getAddress(window, r.x, r.y);
+	uint16_t stride = surface.stride;
+	uint32_t addr = surface.getAddress(r.x, r.y);
 	auto ptr = buffer.getPtr();
 	auto size = buffer.getSize();
 	while(r.height--) {
@@ -233,6 +998,197 @@ uint16_t Gfx::drawFilledRectSlow(Window window, const SeRect& rect, SeColor colo
 	return 0;
 }
 
+uint32_t Gfx::_getBltCost(Window window, BltCmd cmd, SeSize size)
+{
+	SeBltParam blt;
+	if(!bltPrepareSolidFill(blt, window, SePos(0, 0), size, SeColor())) {
+		return 0;
+	}
+	blt.cmd = cmd;
+
+	// Parameter block, start command and status poll
+	return (3 * S1D13781_SPI_SETUP_TIME) + getTransferTime(sizeof(blt) + 4) + getBltScheduler().estimate(blt);
+}
+
+uint16_t Gfx::fillGradient(Window window, const SeRect& rect, SeColor from, SeColor to, GradientDirection direction)
+{
+	if(!getSurface(window).isValid()) {
+		return 1; //error invalid window
+	}
+
+	// Colours are calculated from the position within the given rect, but only the visible part is drawn
+	SeRect r = getClip(window);
+	if(!r.intersect(rect)) {
+		return 0;
+	}
+
+	switch(direction) {
+	case GradientDirection::vertical:
+		return _fillGradientRows(window, rect, r, from, to);
+	case GradientDirection::horizontal:
+		return _fillGradientColumns(window, rect, r, from, to);
+	case GradientDirection::diagonal:
+		return _fillGradientDiagonal(window, rect, r, from, to);
+	default:
+		return 3;
+	}
+}
+
+uint16_t Gfx::_fillGradientRows(Window window, const SeRect& rect, const SeRect& r, SeColor from, SeColor to)
+{
+	auto& surface = getSurface(window);
+	ColorRamp ramp(from, to, rect.height);
+	auto getColor = [&](int y) { return surface.lookupColor(ramp[y - rect.y]); };
+
+	// Adjacent rows with the same colour in the window format are filled together
+	unsigned bandCount = 1;
+	SeColor color = getColor(r.y);
+	for(int y = r.y + 1; y < r.y2(); ++y) {
+		SeColor c = getColor(y);
+		if(c.code != color.code) {
+			++bandCount;
+			color = c;
+		}
+	}
+
+	uint32_t bandCost = bandCount * _getBltCost(window, BltCmd::solidFill, SeSize(r.width, r.height / bandCount));
+	uint32_t rowCost = r.height * _getWriteCost(r.width * surface.bytesPerPixel);
+
+	if(bandCost <= rowCost) {
+		BandFiller filler(*this, window);
+		int y0 = r.y;
+		color = getColor(y0);
+		for(int y = r.y + 1; y <= r.y2(); ++y) {
+			SeColor c = (y < r.y2()) ? getColor(y) : SeColor();
+			if(y == r.y2() || c.code != color.code) {
+				filler.add(SeRect(r.x, y0, r.width, y - y0), color);
+				y0 = y;
+				color = c;
+			}
+		}
+		return 0;
+	}
+
+	PixelBuffer buffer;
+	if(!buffer.initialise(r.width, 1, surface.format)) {
+		return 2;
+	}
+
+	_addDamage(window, r);
+	rasterWait(window, r.getPos(), r.getSize(), rowCost);
+
+	uint32_t addr = surface.getAddress(r.x, r.y);
+	for(int y = r.y; y < r.y2(); ++y) {
+		buffer.fill(getColor(y));
+		write(addr, buffer.getPtr(), buffer.getSize());
+		addr += surface.stride;
+	}
+
+	return 0;
+}
+
+uint16_t Gfx::_fillGradientColumns(Window window, const SeRect& rect, const SeRect& r, SeColor from, SeColor to)
+{
+	auto& surface = getSurface(window);
+	ColorRamp ramp(from, to, rect.width);
+	auto getColor = [&](int x) { return surface.lookupColor(ramp[x - rect.x]); };
+
+	unsigned bandCount = 1;
+	SeColor color = getColor(r.x);
+	for(int x = r.x + 1; x < r.x2(); ++x) {
+		SeColor c = getColor(x);
+		if(c.code != color.code) {
+			++bandCount;
+			color = c;
+		}
+	}
+
+	// Compare filling each band of columns, replicating the first row and writing every row
+	uint32_t bandCost = bandCount * _getBltCost(window, BltCmd::solidFill, SeSize(r.width / bandCount, r.height));
+	uint32_t writeCost = _getWriteCost(r.width * surface.bytesPerPixel);
+	uint32_t doubleCost = writeCost;
+	for(unsigned done = 1; done < r.height; done *= 2) {
+		unsigned count = std::min(done, r.height - done);
+		doubleCost += _getBltCost(window, BltCmd::movePositive, SeSize(r.width, count));
+	}
+	uint32_t rowCost = r.height * writeCost;
+
+	if(bandCost <= doubleCost && bandCost <= rowCost) {
+		BandFiller filler(*this, window);
+		int x0 = r.x;
+		color = getColor(x0);
+		for(int x = r.x + 1; x <= r.x2(); ++x) {
+			SeColor c = (x < r.x2()) ? getColor(x) : SeColor();
+			if(x == r.x2() || c.code != color.code) {
+				filler.add(SeRect(x0, r.y, x - x0, r.height), color);
+				x0 = x;
+				color = c;
+			}
+		}
+		return 0;
+	}
+
+	PixelBuffer buffer;
+	if(!buffer.initialise(r.width, 1, surface.format)) {
+		return 2;
+	}
+	for(unsigned x = 0; x < r.width; ++x) {
+		buffer.setPixel(x, 0, getColor(r.x + x));
+	}
+
+	_addDamage(window, r);
+
+	uint32_t addr = surface.getAddress(r.x, r.y);
+	if(doubleCost <= rowCost) {
+		rasterWait(window, r.getPos(), SeSize(r.width, 1), writeCost);
+		write(addr, buffer.getPtr(), buffer.getSize());
+		_replicateRow(window, r);
+		return 0;
+	}
+
+	rasterWait(window, r.getPos(), r.getSize(), rowCost);
+	for(unsigned y = 0; y < r.height; ++y) {
+		write(addr, buffer.getPtr(), buffer.getSize());
+		addr += surface.stride;
+	}
+
+	return 0;
+}
+
+uint16_t Gfx::_fillGradientDiagonal(Window window, const SeRect& rect, const SeRect& r, SeColor from, SeColor to)
+{
+	auto& surface = getSurface(window);
+	ColorRamp ramp(from, to, rect.width + rect.height - 1);
+
+	/*
+	 * Colour depends only on x + y, so each row is the previous one shifted left by a pixel.
+	 * Build a strip covering all rows; each row is then a single burst write from the appropriate offset.
+	 */
+	unsigned stripWidth = r.width + r.height - 1;
+	PixelBuffer buffer;
+	if(!buffer.initialise(stripWidth, 1, surface.format)) {
+		return 2;
+	}
+	unsigned start = (r.x - rect.x) + (r.y - rect.y);
+	for(unsigned i = 0; i < stripWidth; ++i) {
+		buffer.setPixel(i, 0, surface.lookupColor(ramp[start + i]));
+	}
+
+	_addDamage(window, r);
+
+	unsigned rowSize = r.width * surface.bytesPerPixel;
+	rasterWait(window, r.getPos(), r.getSize(), r.height * _getWriteCost(rowSize));
+
+	auto ptr = static_cast<uint8_t*>(buffer.getPtr());
+	uint32_t addr = surface.getAddress(r.x, r.y);
+	for(unsigned y = 0; y < r.height; ++y) {
+		write(addr, ptr + buffer.getOffset(y, 0), rowSize);
+		addr += surface.stride;
+	}
+
+	return 0;
+}
+
 uint16_t Gfx::drawPattern(Window window, PatternType pattern, uint8_t intensity)
 {
 	if(getBytesPerPixel(window) == 0) {
@@ -259,119 +1215,6 @@ uint16_t Gfx::drawPattern(Window window, PatternType pattern, uint8_t intensity)
 	return 0;
 }
 
-IntersectType Gfx::_getIntersectionPoint(int AX1, int AY1, int AX2, int AY2, int BX1, int BY1, int BX2, int BY2,
-										 int* intersectX, int* intersectY)
-{
-	long a1, a2, b1, b2, c1, c2; // Coefficients of line eqns.
-	long r1, r2, r3, r4;		 // 'Sign' values
-	long denom, offset, num;	 // Intermediate values
-
-	// Compute a1, b1, c1, where line joining points 1 and 2 is "a1 IntersectX  +  b1 IntersectY  +  c1  =  0".
-	a1 = AY2 - AY1;
-	b1 = AX1 - AX2;
-	c1 = AX2 * AY1 - AX1 * AY2;
-
-	// Compute r3 and r4.
-	r3 = a1 * BX1 + b1 * BY1 + c1;
-	r4 = a1 * BX2 + b1 * BY2 + c1;
-
-	// Check signs of r3 and r4.  If both point 3 and point 4 lie on same side of line 1, the line segments do not intersect.
-	if(r3 != 0 && r4 != 0 && seSameSigns(r3, r4))
-		return noIntersect;
-
-	// Compute a2, b2, c2
-	a2 = BY2 - BY1;
-	b2 = BX1 - BX2;
-	c2 = BX2 * BY1 - BX1 * BY2;
-
-	// Compute r1 and r2
-	r1 = a2 * AX1 + b2 * AY1 + c2;
-	r2 = a2 * AX2 + b2 * AY2 + c2;
-
-	// Check signs of r1 and r2.  If both point 1 and point 2 lie on same side of second line segment, the line segments do not intersect.
-	if(r1 != 0 && r2 != 0 && seSameSigns(r1, r2))
-		return noIntersect;
-
-	// Line segments intersect: compute intersection point.
-	denom = a1 * b2 - a2 * b1;
-	if(denom == 0)
-		return collinear;
-
-	offset = (denom < 0) ? -denom / 2 : denom / 2;
-	// The denom/2 is to get rounding instead of truncating.
-	// It is added or subtracted to the numerator, depending upon the sign of the numerator.
-
-	num = b1 * c2 - b2 * c1;
-	*intersectX = (num < 0 ? num - offset : num + offset) / denom;
-
-	num = a2 * c1 - a1 * c2;
-	*intersectY = (num < 0 ? num - offset : num + offset) / denom;
-
-	return intersect;
-}
-
-bool Gfx::_cropLine(int* X1, int* Y1, int* X2, int* Y2, int cropRegionX, int cropRegionY, int cropRegionWidth,
-					int cropRegionHeight)
-{
-	bool lineCropped = false;
-	int RX1 = cropRegionX;
-	int RY1 = cropRegionY;
-	int RX2 = cropRegionX + cropRegionWidth - 1;
-	int RY2 = cropRegionY + cropRegionHeight - 1;
-	int ix = 0;
-	int iy = 0;
-
-	// Does line intersect top horizontal line?
-	if(_getIntersectionPoint(*X1, *Y1, *X2, *Y2, RX1, RY1, RX2, RY1, &ix, &iy) == intersect) {
-		if(*Y1 <= RY1) {
-			*X1 = ix;
-			*Y1 = iy;
-		} else {
-			*X2 = ix;
-			*Y2 = iy;
-		}
-		lineCropped = true;
-	}
-
-	// Does line intersect bottom horizontal line?
-	if(_getIntersectionPoint(*X1, *Y1, *X2, *Y2, RX1, RY2, RX2, RY2, &ix, &iy) == intersect) {
-		if(*Y1 >= RY2) {
-			*X1 = ix;
-			*Y1 = iy;
-		} else {
-			*X2 = ix;
-			*Y2 = iy;
-		}
-		lineCropped = true;
-	}
-
-	// Does line intersect left vertical line?
-	if(_getIntersectionPoint(*X1, *Y1, *X2, *Y2, RX1, RY1, RX1, RY2, &ix, &iy) == intersect) {
-		if(*X1 <= RX1) {
-			*X1 = ix;
-			*Y1 = iy;
-		} else {
-			*X2 = ix;
-			*Y2 = iy;
-		}
-		lineCropped = true;
-	}
-
-	// Does line intersect right vertical line?
-	if(_getIntersectionPoint(*X1, *Y1, *X2, *Y2, RX2, RY1, RX2, RY2, &ix, &iy) == intersect) {
-		if(*X1 >= RX2) {
-			*X1 = ix;
-			*Y1 = iy;
-		} else {
-			*X2 = ix;
-			*Y2 = iy;
-		}
-		lineCropped = true;
-	}
-
-	return lineCropped;
-}
-
 void Gfx::_drawRgbHorizBars(Window window, unsigned int intensity)
 {
 	SeRect r(getWindowSize(window));
@@ -387,36 +1230,14 @@ void Gfx::_drawRgbHorizGradient(Window window)
 {
 	auto windowSize = getWindowSize(window);
 
-	//initialize the values used for the gradients
-	const uint8_t topRed = 0;
-	const uint8_t topGreen = 0;
-	const uint8_t topBlue = 0;
-	const uint8_t bottomRed = 0xFF - topRed;	 // 8 bits Red
-	const uint8_t bottomGreen = 0xFF - topGreen; //8 bits Green
-	const uint8_t bottomBlue = 0xFF - topBlue;   //8 bits Blue
-
-	//do red gradient
 	unsigned bandHeight = windowSize.height / 3;
-	SePos pos(0, 0);
-	SeSize size(windowSize.width, 1);
-	for(unsigned i = 0; i < bandHeight; ++i) {
-		RGBColor color(topRed + (bottomRed * i / bandHeight), 0, 0);
-		bltSolidFill(window, pos, size, color.value);
-		++pos.y;
-	}
-
-	for(unsigned i = 0; i < bandHeight; ++i) {
-		RGBColor color(0, topGreen + (bottomGreen * i / bandHeight), 0);
-		bltSolidFill(window, pos, size, color.value);
-		++pos.y;
-	}
-
-	bandHeight = windowSize.height - pos.y;
-	for(unsigned i = 0; i < bandHeight; ++i) {
-		RGBColor color(0, 0, topBlue + (bottomBlue * i / bandHeight));
-		bltSolidFill(window, pos, size, color.value);
-		++pos.y;
-	}
+	SeRect r(0, 0, windowSize.width, bandHeight);
+	fillGradient(window, r, aclBlack, aclRed, GradientDirection::vertical);
+	r.y += bandHeight;
+	fillGradient(window, r, aclBlack, aclGreen, GradientDirection::vertical);
+	r.y += bandHeight;
+	r.height = windowSize.height - r.y;
+	fillGradient(window, r, aclBlack, aclBlue, GradientDirection::vertical);
 }
 
 void Gfx::_drawVertBars(Window window, unsigned int intensity)
@@ -430,7 +1251,7 @@ void Gfx::_drawVertBars(Window window, unsigned int intensity)
 	SeSize size(windowSize.width / ARRAY_SIZE(colors), windowSize.height);
 	for(unsigned i = 0; i < ARRAY_SIZE(colors); ++i) {
 		auto color = scaleColor(colors[i], intensity);
-		bltSolidFill(window, pos, size, color);
+		drawFilledRect(window, SeRect(pos, size), color);
 		pos.x += size.width;
 	}
 }
@@ -438,19 +1259,16 @@ void Gfx::_drawVertBars(Window window, unsigned int intensity)
 unsigned int Gfx::drawTextTransparent(Window window, const SeFont& font, const char* text, int X, int Y,
 									  unsigned int width, SeColor fgColor, bool wordCrop, bool* cropped)
 {
-	// Optimise DrawPixel by caching parameters on first call
-	bool newPixelDraw = true;
-
-	SeRect rcWin(getWindowSize(window));
+	SeRect rcClip = getClip(window);
 
 	//initialize some values that we need
-	unsigned displayWidth = (width == 0) ? rcWin.width : width;
+	unsigned displayWidth = (width == 0) ? getWidth(window) : width;
 	SeRect rcChar;
 	rcChar.height = font.getHeight();
 	rcChar.x = X;
 	rcChar.y = Y;
-	int yStart = (Y >= 0) ? 0 : -Y;
-	int yEnd = (Y + rcChar.height < rcWin.height) ? rcChar.height : rcWin.height - Y;
+	int yStart = std::max(rcClip.y - Y, 0);
+	int yEnd = std::min(rcClip.y2() - Y, int(rcChar.height));
 
 	// Determine how many characters to draw.
 	unsigned nChars = font.measureText(text, displayWidth, wordCrop, cropped);
@@ -460,25 +1278,26 @@ unsigned int Gfx::drawTextTransparent(Window window, const SeFont& font, const c
 	}
 
 	fgColor = lookupColor(window, fgColor);
+	PixelBatcher batcher(*this, window);
 	int xo, yo;
 	for(unsigned iText = 0; iText < nCharsToDraw; iText++) {
 		rcChar.width = font.getCharWidth(text[iText]);
 
-		if(rcWin.overlap(rcChar)) {
-			int xStart = (rcChar.x >= 0) ? 0 : -rcChar.x;
-			int xEnd = (rcChar.x2() < int(rcWin.width)) ? rcChar.width : rcWin.width - rcChar.x;
+		if(rcClip.overlap(rcChar)) {
+			int xStart = std::max(rcClip.x - rcChar.x, 0);
+			int xEnd = std::min(rcClip.x2() - rcChar.x, int(rcChar.width));
 			SeCharOffset offset = font.getCharOffset(wchar_t(uint8_t(text[iText])));
 
 			if(rcChar.width > 0) {
 				if(offset.X != seNO_GLYPH) {
+					_addDamage(window, rcChar);
 					// Draw character glyph.
 					for(yo = yStart; yo < yEnd; yo++) {
 						uint32_t w = font.getGlyphBits(offset, yo);
 						w <<= xStart;
 						for(xo = xStart; xo < xEnd; xo++) {
 							if(w & 0x80000000) {
-								drawPixel(window, rcChar.x + xo, rcChar.y + yo, fgColor, newPixelDraw);
-								newPixelDraw = false;
+								batcher.setPixel(rcChar.x + xo, rcChar.y + yo, fgColor);
 							}
 							w <<= 1;
 						}
@@ -514,80 +1333,182 @@ unsigned int Gfx::drawText(Window window, const SeFont& font, const char* text,
 		return drawTextTransparent(window, font, text, X, Y, width, fgColor, wordCrop, cropped);
 	}
 
-	// Determine visible area
-	SeSize windowSize = getWindowSize(window);
-	unsigned displayWidth = (width == 0) ? windowSize.width : width;
 	// Determine how many characters to draw
+	unsigned displayWidth = (width == 0) ? getWidth(window) : width;
 	unsigned nChars = font.measureText(text, displayWidth, wordCrop, cropped);
 	unsigned nCharsToDraw = nChars;
-	//	while(nCharsToDraw > 0) {
-	//		char c = text[nCharsToDraw - 1];
-	//		if(c == ' ' || c == '\t' || c == '\r' || c == '\n') {
-	//			--nCharsToDraw;
-	//		} else {
-	//			break;
-	//		}
-	//	}
-
-	// Use a rect to maintain the position and size of the character being drawn
-	SeRect rcChar;
-	rcChar.height = font.getHeight();
-	rcChar.y = Y;
-	unsigned yStartOffset = (Y >= 0) ? 0 : unsigned(-Y);
-	unsigned yEndOffset = (rcChar.y2() < windowSize.height) ? rcChar.height : unsigned(windowSize.height - Y);
 
-	// Built text in buffer, 1 bit per pixel
+	// Determine visible area
+	SeRect rcText(X, Y, 0, font.getHeight());
+	for(unsigned iText = 0; iText < nCharsToDraw; ++iText) {
+		rcText.width += font.getCharWidth(text[iText]);
+	}
+	SeRect rcVisible = getClip(window);
+	if(!rcVisible.intersect(rcText)) {
+		return nChars;
+	}
+
+	// Glyphs can only be drawn from the atlas in their entirety
+	if(glyphAtlas.isActive() && rcVisible.contains(rcText) &&
+	   _drawTextCached(window, font, text, nCharsToDraw, X, Y, fgColor, bgColor)) {
+		return nChars;
+	}
+
+	// Built visible part of text in buffer, 1 bit per pixel
 	BitBuffer buffer;
-	buffer.initialise(displayWidth, rcChar.height);
+	if(!buffer.initialise(rcVisible.width, rcVisible.height)) {
+		return 0;
+	}
 
-	for(unsigned yOffset = yStartOffset; yOffset < yEndOffset; ++yOffset) {
-		rcChar.x = X;
-		for(unsigned iText = 0; iText < nCharsToDraw; ++iText) {
-			rcChar.width = font.getCharWidth(text[iText]);
-			if(rcChar.width == 0) {
+	for(int y = rcVisible.y; y < rcVisible.y2(); ++y) {
+		unsigned yOffset = y - Y;
+		int x = X;
+		for(unsigned iText = 0; iText < nCharsToDraw && x < rcVisible.x2(); ++iText) {
+			unsigned charWidth = font.getCharWidth(text[iText]);
+			if(x + int(charWidth) <= rcVisible.x) {
+				x += charWidth;
 				continue;
 			}
 
-			if(rcChar.x2() > windowSize.width) {
-				//				debug_e("CHAR OVERFLOW, %u > %u", rcChar.x2(), windowSize.width);
-				break;
-			}
-
 			SeCharOffset charOffset = font.getCharOffset(wchar_t(text[iText]));
-			if(charOffset.X == seNO_GLYPH) {
-				buffer.skip(rcChar.width);
-			} else {
-				uint32_t w = font.getGlyphBits(charOffset, yOffset);
-				for(unsigned xOffset = 0; xOffset < rcChar.width; ++xOffset) {
+			uint32_t w = (charOffset.X == seNO_GLYPH) ? 0 : font.getGlyphBits(charOffset, yOffset);
+			for(unsigned xOffset = 0; xOffset < charWidth; ++xOffset, ++x) {
+				if(x >= rcVisible.x && x < rcVisible.x2()) {
 					buffer.setPixel(w & 0x80000000);
-					w <<= 1;
 				}
-
-				//				for(unsigned xOffset = 0; xOffset < rcChar.width; ++xOffset) {
-				//					buffer.setPixel(font.testGlyphPixel(charOffset, xOffset, yOffset));
-				//				}
+				w <<= 1;
 			}
+		}
+	}
+
+	uint32_t srcAddr = _getTextScratch(buffer.getPos());
+	if(srcAddr == VramHeap::invalid) {
+		// No display memory for the bitmap, so fill the background and draw the glyphs as pixels
+		drawFilledRect(window, rcVisible, bgColor);
+		drawTextTransparent(window, font, text, X, Y, width, fgColor, wordCrop, nullptr);
+		return nChars;
+	}
+	write(srcAddr, buffer.getPtr(), buffer.getPos());
+
+	bltMoveExpand(window, srcAddr, rcVisible.getPos(), rcVisible.getSize(), fgColor, bgColor);
+	_addDamage(window, rcVisible);
+
+	return nChars;
+}
 
-			rcChar.x += rcChar.width;
+bool Gfx::_drawTextCached(Window window, const SeFont& font, const char* text, unsigned length, int X, int Y,
+						  SeColor fgColor, SeColor bgColor)
+{
+	unsigned height = font.getHeight();
+	for(unsigned i = 0; i < length; ++i) {
+		if(!glyphAtlas.canHold(font.getCharWidth(text[i]), height)) {
+			return false;
 		}
 	}
 
-	//		buffer.print("T", vramAddress);
+	uint16_t windowWidth = getWidth(window);
+	int x = X;
+	for(unsigned i = 0; i < length; ++i) {
+		uint8_t ch = text[i];
+		unsigned charWidth = font.getCharWidth(ch);
+		if(charWidth == 0) {
+			continue;
+		}
 
-	uint32_t srcAddr = S1D13781_LUT1_BASE - buffer.getPos();
-	write(srcAddr, buffer.getPtr(), buffer.getPos());
+		if(x + int(charWidth) > windowWidth) {
+			break;
+		}
 
-	//	if(srcBufPos > srcBufSize) {
-	//		debug_e("SRCBUF OVERFLOW: %u, %u", srcBufPos, srcBufSize);
-	//	}
+		SePos pos(x, Y);
+		SeSize size(charWidth, height);
+		SeCharOffset charOffset = font.getCharOffset(wchar_t(ch));
+		uint32_t srcAddr;
+		if(charOffset.X == seNO_GLYPH) {
+			bltSolidFill(window, pos, size, bgColor);
+		} else if((srcAddr = glyphAtlas.getGlyph(font, ch, charOffset, charWidth)) != GlyphAtlas::invalid) {
+			bltMoveExpand(window, srcAddr, pos, size, fgColor, bgColor);
+		}
 
-	//	m_printHex("scratch", buffer, bufPos);
+		x += charWidth;
+	}
 
-	bltMoveExpand(window, srcAddr, SePos(X, Y), SeSize(rcChar.x - X, rcChar.height), fgColor, bgColor);
+	_addDamage(window, SeRect(X, Y, x - X, height));
 
-	//	debug_i("drawText() - %u", nChars);
+	return true;
+}
 
-	return nChars;
+void Gfx::setDamageTracking(Window window)
+{
+	damageWindow = window;
+	damage.setBounds(SeRect(getWindowSize(window)));
+}
+
+void Gfx::clearDamage()
+{
+	damage.clear(getBytesPerPixel(damageWindow));
+}
+
+uint32_t Gfx::flushDamage(const void* shadow, unsigned shadowStride)
+{
+	auto& surface = getSurface(damageWindow);
+	if(!surface.isValid()) {
+		return 0;
+	}
+
+	auto src = static_cast<const uint8_t*>(shadow);
+	uint32_t byteCount = 0;
+	for(auto& r : damage) {
+		auto ptr = src + (r.y * shadowStride) + (r.x * surface.bytesPerPixel);
+		uint32_t addr = surface.getAddress(r.x, r.y);
+		unsigned rowBytes = r.width * surface.bytesPerPixel;
+		if(rowBytes == surface.stride && shadowStride == surface.stride) {
+			// Full-width rows are contiguous in both buffers
+			write(addr, ptr, r.height * rowBytes);
+		} else {
+			for(unsigned y = 0; y < r.height; ++y) {
+				write(addr, ptr, rowBytes);
+				addr += surface.stride;
+				ptr += shadowStride;
+			}
+		}
+		byteCount += r.height * rowBytes;
+	}
+
+	damage.clear(surface.bytesPerPixel);
+	return byteCount;
+}
+
+uint32_t Gfx::_getTextScratch(unsigned size)
+{
+	if(size <= textScratchSize) {
+		return textScratch;
+	}
+
+	auto& vram = getVram();
+	if(textScratchFailed) {
+		// Don't retry until more display memory has been released
+		if(vram.getStats().largestFree <= textScratchLargestFree) {
+			return VramHeap::invalid;
+		}
+		textScratchFailed = false;
+	}
+
+	// Round up to reduce re-allocations as text length varies
+	unsigned allocSize = (size + 63) & ~63;
+	auto addr = vram.alloc(allocSize);
+	if(addr == VramHeap::invalid) {
+		// The current block remains usable for smaller text
+		textScratchFailed = true;
+		textScratchLargestFree = vram.getStats().largestFree;
+		return VramHeap::invalid;
+	}
+
+	if(textScratch != VramHeap::invalid) {
+		vram.free(textScratch);
+	}
+	textScratch = addr;
+	textScratchSize = allocSize;
+	return textScratch;
 }
 
 unsigned int Gfx::drawMultiLineText(Window window, const SeFont& font, const char* text, int X, int Y,
@@ -652,41 +1573,443 @@ unsigned int Gfx::drawMultiLineTextW(WindowDestination window, const SeFont& fon
 */
 
 void Gfx::drawImage(const FSTR::ObjectBase& image, Window window, int x, int y, unsigned imageWidth,
-					unsigned imageHeight)
+					unsigned imageHeight, uint8_t xScale, uint8_t yScale)
 {
-	unsigned xs = 1;
-	unsigned ys = 1;
+	unsigned xs = xScale ?: 1;
+	unsigned ys = yScale ?: 1;
+
+	auto& surface = getSurface(window);
+	if(!surface.isValid()) {
+		return;
+	}
+
+	// Only the visible part of the image is read and written
+	SeRect r(x, y, imageWidth * xs, imageHeight * ys);
+	if(!r.intersect(getClip(window))) {
+		return;
+	}
+	unsigned srcX = (r.x - x) / xs;
+	unsigned srcWidth = (r.x2() - x + xs - 1) / xs - srcX;
 
 	// Assume 24-bit RGB source data
 	PixelBuffer sourceBuffer;
-	if(!sourceBuffer.initialise(imageWidth, 1, format_RGB_888)) {
+	if(!sourceBuffer.initialise(srcWidth, 1, format_RGB_888)) {
 		return;
 	}
 
-	PixelBuffer destBuffer;
-	if(!destBuffer.initialise(imageWidth * xs, 1, getColorDepth(window))) {
+	// Scaled rows are converted once, then each pixel is repeated into the output row
+	PixelBuffer scaleBuffer;
+	if(xs > 1 && !scaleBuffer.initialise(srcWidth, 1, surface.format)) {
 		return;
 	}
 
-	unsigned windowStride = getStride(window);
-	unsigned vramAddress = getStartAddress(window) + (y * windowStride) + (x * destBuffer.getBytesPerPixel());
-	unsigned imageStride = sourceBuffer.getStride();
-	for(unsigned y = 0; y < imageHeight; ++y) {
-		image.read(y * imageStride, static_cast<char*>(sourceBuffer.getPtr()), imageStride);
-		for(unsigned x = 0; x < imageWidth; ++x) {
-			auto color = sourceBuffer.getPixel(x, 0);
-			color = HSPI::bswap24(color);
-			color = lookupColor(window, color);
-			for(unsigned i = 0; i < xs; ++i) {
-				destBuffer.setPixel((x * xs) + i, 0, color);
+	// One buffer is converted while the other is being written
+	PixelBuffer destBuffers[2];
+	for(auto& buffer : destBuffers) {
+		if(!buffer.initialise(r.width, 1, surface.format)) {
+			return;
+		}
+	}
+
+	unsigned rowSize = destBuffers[0].getStride();
+	unsigned rowCount = (r.y2() - y + ys - 1) / ys - (r.y - y) / ys;
+	_addDamage(window, r);
+	rasterWait(window, r.getPos(), r.getSize(), getTransferTime(rowSize * rowCount));
+
+	auto startTime = micros();
+	unsigned imageStride = imageWidth * sourceBuffer.getBytesPerPixel();
+	unsigned srcOffset = srcX * sourceBuffer.getBytesPerPixel();
+	unsigned skip = (r.x - x) % xs;
+	auto srcData = static_cast<const uint8_t*>(sourceBuffer.getPtr());
+	unsigned current = 0;
+	uint32_t sourceBytes = 0;
+	uint32_t written = 0;
+	for(unsigned dy = 0; dy < r.height;) {
+		// Display rows [dy, bandEnd) all show the same image row
+		unsigned row = (r.y - y + dy) / ys;
+		unsigned bandEnd = std::min((row + 1) * ys - (r.y - y), unsigned(r.height));
+
+		sourceBytes += sourceBuffer.getStride();
+		// The write in progress (if any) is from the other buffer
+		current ^= 1;
+		image.read(row * imageStride + srcOffset, static_cast<char*>(sourceBuffer.getPtr()), sourceBuffer.getStride());
+		auto destData = static_cast<uint8_t*>(destBuffers[current].getPtr());
+		if(xs == 1) {
+			convertImagePixels(destData, surface.format, srcData, r.width);
+		} else {
+			auto scaleData = static_cast<uint8_t*>(scaleBuffer.getPtr());
+			convertImagePixels(scaleData, surface.format, srcData, srcWidth);
+			scaleRow(destData, scaleData, surface.bytesPerPixel, skip, r.width, xs);
+		}
+
+		wait(reqWr);
+		write(reqWr, surface.getAddress(r.x, r.y + dy), destData, rowSize);
+		written += rowSize;
+
+		// Copy the row just written to the rest of the band
+		_replicateRow(window, SeRect(r.x, r.y + dy, r.width, bandEnd - dy));
+		dy = bandEnd;
+	}
+
+	// Buffers must remain valid until the final write completes
+	wait(reqWr);
+
+	_imageDrawn(written, sourceBytes, sourceBytes, startTime);
+}
+
+uint16_t Gfx::drawImage(const FSTR::ObjectBase& image, Window window, int x, int y, uint8_t scale)
+{
+	auto& surface = getSurface(window);
+	if(!surface.isValid()) {
+		return 1; //error invalid window
+	}
+
+	ImageHeader header;
+	if(image.read(0, &header, sizeof(header)) != sizeof(header) || !header.isValid()) {
+		return 3; //invalid image
+	}
+
+	unsigned xs = scale ?: 1;
+	unsigned ys = xs;
+
+	if(header.isCompressed()) {
+		return _drawImageRle(image, header, window, x, y, xs);
+	}
+
+	if(image.size() < sizeof(header) + uint32_t(header.stride) * header.height) {
+		return 3; //invalid image
+	}
+
+	SeRect r(x, y, header.width * xs, header.height * ys);
+	if(!r.intersect(getClip(window))) {
+		return 0;
+	}
+	unsigned srcX = (r.x - x) / xs;
+	unsigned srcWidth = (r.x2() - x + xs - 1) / xs - srcX;
+
+	// Each storage layout has a distinct pixel size
+	auto srcFormat = header.getFormat();
+	unsigned srcBytesPP = header.getBytesPerPixel();
+	bool convert = (srcBytesPP != surface.bytesPerPixel);
+
+	// Scaled rows are converted (if required) before each pixel is repeated into the output row
+	PixelBuffer scaleBuffer;
+	if(convert && xs > 1 && !scaleBuffer.initialise(srcWidth, 1, surface.format)) {
+		return 2;
+	}
+
+	// One buffer is filled while the other is being written
+	PixelBuffer srcBuffers[2];
+	PixelBuffer destBuffers[2];
+	for(unsigned i = 0; i < 2; ++i) {
+		if(!srcBuffers[i].initialise(srcWidth, 1, srcFormat)) {
+			return 2;
+		}
+		if((convert || xs > 1) && !destBuffers[i].initialise(r.width, 1, surface.format)) {
+			return 2;
+		}
+	}
+
+	unsigned srcSize = srcWidth * srcBytesPP;
+	unsigned rowSize = r.width * surface.bytesPerPixel;
+	unsigned rowCount = (r.y2() - y + ys - 1) / ys - (r.y - y) / ys;
+	_addDamage(window, r);
+	rasterWait(window, r.getPos(), r.getSize(), getTransferTime(rowSize * rowCount));
+
+	auto startTime = micros();
+	uint32_t srcOffset = sizeof(header) + srcX * srcBytesPP;
+	unsigned skip = (r.x - x) % xs;
+	unsigned current = 0;
+	for(unsigned dy = 0; dy < r.height;) {
+		// Display rows [dy, bandEnd) all show the same image row
+		unsigned row = (r.y - y + dy) / ys;
+		unsigned bandEnd = std::min((row + 1) * ys - (r.y - y), unsigned(r.height));
+
+		current ^= 1;
+		void* data = srcBuffers[current].getPtr();
+		image.read(srcOffset + row * header.stride, data, srcSize);
+		if(xs > 1) {
+			if(convert) {
+				convertPixels(scaleBuffer.getPtr(), surface.format, data, srcFormat, srcWidth);
+				data = scaleBuffer.getPtr();
+			}
+			scaleRow(static_cast<uint8_t*>(destBuffers[current].getPtr()), static_cast<const uint8_t*>(data),
+					 surface.bytesPerPixel, skip, r.width, xs);
+			data = destBuffers[current].getPtr();
+		} else if(convert) {
+			convertPixels(destBuffers[current].getPtr(), surface.format, data, srcFormat, r.width);
+			data = destBuffers[current].getPtr();
+		}
+
+		wait(reqWr);
+		write(reqWr, surface.getAddress(r.x, r.y + dy), data, rowSize);
+
+		// Copy the row just written to the rest of the band
+		_replicateRow(window, SeRect(r.x, r.y + dy, r.width, bandEnd - dy));
+		dy = bandEnd;
+	}
+
+	// Buffers must remain valid until the final write completes
+	wait(reqWr);
+
+	_imageDrawn(rowSize * rowCount, srcSize * rowCount, srcSize * rowCount, startTime);
+
+	return 0;
+}
+
+uint16_t Gfx::_drawImageRle(const FSTR::ObjectBase& image, const ImageHeader& header, Window window, int x, int y,
+							unsigned scale)
+{
+	auto& surface = getSurface(window);
+	SeRect clip = getClip(window);
+	SeRect r(x, y, header.width * scale, header.height * scale);
+	if(!r.intersect(clip)) {
+		return 0;
+	}
+
+	auto srcFormat = header.getFormat();
+	unsigned srcBytesPP = header.getBytesPerPixel();
+	unsigned destBytesPP = surface.bytesPerPixel;
+
+	// Pixels of the current row which are to be written, in the window format
+	PixelBuffer rowBuffer;
+	if(!rowBuffer.initialise(header.width, 1, surface.format)) {
+		return 2;
+	}
+	auto rowData = static_cast<uint8_t*>(rowBuffer.getPtr());
+
+	// Pending pixels with each one repeated horizontally
+	PixelBuffer scaleBuffer;
+	if(scale > 1 && !scaleBuffer.initialise(header.width * scale, 1, surface.format)) {
+		return 2;
+	}
+	auto scaleData = static_cast<uint8_t*>(scaleBuffer.getPtr());
+
+	_addDamage(window, r);
+
+	auto startTime = micros();
+	FlashReader reader(image, sizeof(header));
+	unsigned px = 0;
+	unsigned py = 0;
+	int literalStart = -1;
+	uint32_t written = 0;
+	uint32_t saved = 0;
+
+	// Write any pending pixels up to the current position
+	auto flushLiteral = [&]() {
+		if(literalStart < 0) {
+			return;
+		}
+		int spanX = x + literalStart * scale;
+		SeRect span(spanX, y + py * scale, (px - literalStart) * scale, scale);
+		if(span.intersect(clip)) {
+			unsigned size = span.width * destBytesPP;
+			auto data = &rowData[literalStart * destBytesPP];
+			if(scale == 1) {
+				data += (span.x - spanX) * destBytesPP;
+			} else {
+				scaleRow(scaleData, data, destBytesPP, span.x - spanX, span.width, scale);
+				data = scaleData;
+			}
+			write(surface.getAddress(span.x, span.y), data, size);
+			_replicateRow(window, span);
+			written += size;
+		}
+		literalStart = -1;
+	};
+
+	// Pending pixels have been added to the current row
+	auto advance = [&](unsigned count) {
+		if(literalStart < 0) {
+			literalStart = px;
+		}
+		px += count;
+		if(px == header.width) {
+			flushLiteral();
+			px = 0;
+			++py;
+		}
+	};
+
+	auto fill = [&](SeRect area, SeColor color) {
+		drawFilledRect(window, area, color);
+		// Nothing is sent for rectangles outside the clip area
+		if(!area.intersect(clip)) {
+			return;
+		}
+		const unsigned overhead = sizeof(SeBltParam) + 2;
+		written += overhead;
+		if(area.area() * destBytesPP > overhead) {
+			saved += area.area() * destBytesPP - overhead;
+		}
+	};
+
+	auto run = [&](const uint8_t* pixel, SeColor color, unsigned count) {
+		while(count != 0) {
+			// Whole rows become a single rectangle
+			if(px == 0 && count >= header.width) {
+				unsigned rows = count / header.width;
+				if(rows * header.width * scale * destBytesPP >= S1D13781_IMAGE_RUN_FILL) {
+					fill(SeRect(x, y + py * scale, header.width * scale, rows * scale), color);
+					py += rows;
+					count -= rows * header.width;
+					continue;
+				}
+			}
+
+			unsigned n = std::min(count, header.width - px);
+			if(n * scale * destBytesPP >= S1D13781_IMAGE_RUN_FILL) {
+				flushLiteral();
+				fill(SeRect(x + px * scale, y + py * scale, n * scale, scale), color);
+				px += n;
+				if(px == header.width) {
+					px = 0;
+					++py;
+				}
+			} else {
+				for(unsigned i = 0; i < n; ++i) {
+					memcpy(&rowData[(px + i) * destBytesPP], pixel, destBytesPP);
+				}
+				advance(n);
+			}
+			count -= n;
+		}
+	};
+
+	while(py < header.height) {
+		uint8_t ctrl;
+		if(!reader.read(&ctrl, 1)) {
+			return 3;
+		}
+		unsigned count = ctrl & 0x3f;
+		if(ctrl & ImageHeader::rleLong) {
+			uint8_t low;
+			if(!reader.read(&low, 1)) {
+				return 3;
 			}
+			count = (count << 8) | low;
 		}
+		++count;
+		if(count > (header.height - py) * header.width - px) {
+			return 3; // overrun
+		}
+
+		if(ctrl & ImageHeader::rleRun) {
+			uint8_t srcPixel[3];
+			uint8_t pixel[3]{};
+			if(!reader.read(srcPixel, srcBytesPP)) {
+				return 3;
+			}
+			convertPixels(pixel, surface.format, srcPixel, srcFormat, 1);
+			SeColor color(pixel[0] | (pixel[1] << 8) | (pixel[2] << 16), surface.format);
+			run(pixel, color, count);
+			continue;
+		}
+
+		// Literal pixels, converted straight into the row buffer
+		while(count != 0) {
+			uint8_t srcPixels[32 * 3];
+			unsigned n = std::min(std::min(count, 32U), header.width - px);
+			if(!reader.read(srcPixels, n * srcBytesPP)) {
+				return 3;
+			}
+			convertPixels(&rowData[px * destBytesPP], surface.format, srcPixels, srcFormat, n);
+			advance(n);
+			count -= n;
+		}
+	}
 
-		for(unsigned i = 0; i < ys; ++i) {
-			write(vramAddress, destBuffer.getPtr(), destBuffer.getStride());
-			vramAddress += windowStride;
+	imageStats.savedBytes += saved;
+	_imageDrawn(written, sizeof(header) + reader.getBytesRead(), header.stride * header.height, startTime);
+
+	return 0;
+}
+
+void Gfx::_replicateRow(Window window, const SeRect& area)
+{
+	// Each move copies everything drawn so far
+	for(unsigned done = 1; done < area.height; done *= 2) {
+		unsigned count = std::min(done, area.height - done);
+		bltMove(window, BltCmd::movePositive, area.getPos(), SePos(area.x, area.y + done), SeSize(area.width, count));
+	}
+}
+
+void Gfx::_imageDrawn(uint32_t byteCount, uint32_t sourceBytes, uint32_t imageBytes, uint32_t startTime)
+{
+	++imageStats.count;
+	imageStats.bytes += byteCount;
+	imageStats.sourceBytes += sourceBytes;
+	imageStats.imageBytes += imageBytes;
+	imageStats.time += micros() - startTime;
+	imageStats.transferTime += getTransferTime(byteCount);
+}
+
+uint16_t Gfx::fillPattern(Window window, const SeRect& rect, const FSTR::ObjectBase& tile, unsigned tileWidth,
+						  unsigned tileHeight)
+{
+	auto& surface = getSurface(window);
+	if(!surface.isValid()) {
+		return 1; //error invalid window
+	}
+
+	SeRect r = getClip(window);
+	if(tileWidth == 0 || tileHeight == 0 || !r.intersect(rect)) {
+		return 0;
+	}
+
+	/*
+	 * The pattern repeats every tile, so any tile-sized block is enough to reproduce it
+	 * provided copies are made at multiples of the tile size.
+	 * Write the block at the top-left of the visible area, starting part-way into the tile if clipped.
+	 */
+	unsigned blockWidth = std::min(tileWidth, unsigned(r.width));
+	unsigned blockHeight = std::min(tileHeight, unsigned(r.height));
+	unsigned tileX = (r.x - rect.x) % tileWidth;
+	unsigned tileY = (r.y - rect.y) % tileHeight;
+
+	// Assume 24-bit RGB source data
+	PixelBuffer sourceBuffer;
+	if(!sourceBuffer.initialise(tileWidth, 1, format_RGB_888)) {
+		return 2;
+	}
+
+	PixelBuffer tileBuffer;
+	if(!tileBuffer.initialise(tileWidth, 1, surface.format)) {
+		return 2;
+	}
+
+	PixelBuffer destBuffer;
+	if(!destBuffer.initialise(blockWidth, 1, surface.format)) {
+		return 2;
+	}
+
+	_addDamage(window, r);
+	rasterWait(window, r.getPos(), SeSize(blockWidth, blockHeight),
+			   getTransferTime(destBuffer.getStride() * blockHeight));
+
+	uint32_t vramAddress = surface.getAddress(r.x, r.y);
+	for(unsigned dy = 0; dy < blockHeight; ++dy) {
+		unsigned row = (tileY + dy) % tileHeight;
+		tile.read(row * sourceBuffer.getStride(), static_cast<char*>(sourceBuffer.getPtr()), sourceBuffer.getStride());
+		convertImagePixels(tileBuffer.getPtr(), surface.format, sourceBuffer.getPtr(), tileWidth);
+		for(unsigned dx = 0; dx < blockWidth; ++dx) {
+			destBuffer.setPixel(dx, 0, tileBuffer.getPixel((tileX + dx) % tileWidth, 0));
 		}
+		write(vramAddress, destBuffer.getPtr(), destBuffer.getStride());
+		vramAddress += surface.stride;
+	}
+
+	// Each move copies everything drawn so far, first along the rows then down the rectangle
+	for(unsigned done = blockWidth; done < r.width; done *= 2) {
+		SeSize size(std::min(done, r.width - done), blockHeight);
+		bltMove(window, BltCmd::movePositive, r.getPos(), SePos(r.x + done, r.y), size);
+	}
+	for(unsigned done = blockHeight; done < r.height; done *= 2) {
+		SeSize size(r.width, std::min(done, r.height - done));
+		bltMove(window, BltCmd::movePositive, r.getPos(), SePos(r.x, r.y + done), size);
 	}
+
+	return 0;
 }
 
 //TODO add to future versions of library
@@ -706,16 +2029,37 @@ uint16_t Gfx::copyArea(Window srcWindow, Window destWindow, SeRect area, int des
 		return 1;
 	}
 
+	// Only copy the part of the area which is visible at the destination
+	SeRect rcDest = getClip(destWindow);
+	if(!rcDest.intersect(SeRect(destX, destY, area.width, area.height))) {
+		return 0;
+	}
+	area.x += rcDest.x - destX;
+	area.y += rcDest.y - destY;
+	area.width = rcDest.width;
+	area.height = rcDest.height;
+	destX = rcDest.x;
+	destY = rcDest.y;
+
+	_addDamage(destWindow, rcDest);
+
 	//get some window information
 	ImageDataFormat srcFormat = getColorDepth(srcWindow);
 	ImageDataFormat destFormat = getColorDepth(destWindow);
 
 	//if window formats are the same, use BitBLT function
-	if((srcWindow == destWindow) && (srcFormat == destFormat)) {
+	if(srcFormat != destFormat) {
+		// Surface formats are different, convert via a line buffer
+		return _copyRegion(srcWindow, destWindow, area, destX, destY);
+	} else if(srcWindow == destWindow) {
 		return _bitBLTRegion(srcWindow, area, destX, destY);
 	} else {
-		// Surface formats are different, use simply copy
-		return _copyRegion(srcWindow, destWindow, area, destX, destY);
+		// Both windows are in display memory so the BLT engine can copy between them
+		if(bltMove(srcWindow, area.getPos(), destWindow, SePos(destX, destY), area.getSize())) {
+			return 0;
+		}
+		// Windows are valid unless disabled, so otherwise an overlapping copy couldn't allocate its buffer
+		return (getSurface(srcWindow).isValid() && getSurface(destWindow).isValid()) ? 2 : 1;
 	}
 }
 
@@ -739,116 +2083,73 @@ uint16_t Gfx::_bitBLTRegion(Window window, const SeRect& area, int destX, int de
 
 uint16_t Gfx::_copyRegion(Window srcWindow, Window destWindow, SeRect area, int16_t destX, int16_t destY)
 {
-	int16_t xStart = 0;
-	int16_t yStart = 0;
-	int xInc = 1;
-	int yInc = 1;
-	int16_t X, Y; //loop vars
-	int16_t xCount, yCount;
-
-	uint16_t returnValue = 0; //default return is 0
-
-	uint16_t srcStride = getStride(srcWindow);
-	uint16_t destStride = getStride(destWindow);
-
-	if(srcStride == 0 || destStride == 0) {
+	auto& srcSurface = getSurface(srcWindow);
+	auto& destSurface = getSurface(destWindow);
+	if(!srcSurface.isValid() || !destSurface.isValid()) {
 		return 1; //invalid window error
 	}
 
-	//get some window information and initialize some values
-	ImageDataFormat srcFormat = getColorDepth(srcWindow);
-	uint32_t srcStartAddr = getStartAddress(srcWindow);
-	uint16_t srcBytesPP = getBytesPerPixel(srcWindow);
-
-	ImageDataFormat destFormat = getColorDepth(destWindow);
-	uint32_t destStartAddr = getStartAddress(destWindow);
-
 	// Calculate width / height based on destination
-	uint16_t width = getWidth(destWindow);
+	uint16_t width = destSurface.size.width;
 	width = destX + area.width > int(width) ? uint16_t(width - destX) : area.width;
 
-	uint16_t height = getHeight(destWindow);
+	uint16_t height = destSurface.size.height;
 	height = destY + area.height > int(height) ? uint16_t(height - destY) : area.height;
 
-	int16_t xEnd = width;
-	int16_t yEnd = height;
+	if(width == 0 || height == 0) {
+		return 0;
+	}
 
-	// Check to see if regions are overlapping in a way that requires a reverse copy
-	SeRect r1(area.x + xStart, area.y + yStart, xEnd - xStart + 1, yEnd - yStart + 1);
-	SeRect r2(destX + xStart, destY + yStart, xEnd - xStart + 1, yEnd - yStart + 1);
-	if(srcWindow == destWindow && (destY >= area.y) && r1.overlap(r2)) {
-		seSwap(xStart, xEnd);
-		seSwap(yStart, yEnd);
-		xStart--;
-		xEnd--;
-		yStart--;
-		yEnd--;
-		xInc = -xInc;
-		yInc = -yInc;
-	}
-
-	//if window formats are the same, simply copy the image data
-	if(srcFormat == destFormat) {
-		unsigned rowCopyBytes = srcBytesPP * width; //how many bytes to copy
-		unsigned srcByteOffset, destByteOffset;
-
-		//copy each line a stride at a time using a line buffer to increase performance.
-		srcByteOffset = srcBytesPP * area.x;
-		destByteOffset = srcBytesPP * destX;
-		//allocate line buffer memory
-		auto lineOfPixelData = new uint8_t[rowCopyBytes]; //allocate memory
-		if(lineOfPixelData == nullptr) {
+	// Copy from the bottom up if a top-down copy would overwrite source rows before they're read
+	int y = 0;
+	int yInc = 1;
+	if(srcWindow == destWindow && destY >= area.y && area.overlap(SeRect(destX, destY, width, height))) {
+		y = height - 1;
+		yInc = -1;
+	}
+
+	// Double-buffer rows so the next one can be read while the current one is converted and written
+	bool convert = (srcSurface.format != destSurface.format);
+	PixelBuffer srcBuffer[2];
+	PixelBuffer destBuffer[2];
+	for(unsigned i = 0; i < 2; ++i) {
+		if(!srcBuffer[i].initialise(width, 1, srcSurface.format)) {
 			return 2; // memory alloc failed
 		}
-
-		//now copy the image data
-		for(yCount = height, Y = yStart; yCount > 0; yCount--, Y += yInc) {
-			read(srcStartAddr + ((area.y + Y) * srcStride) + srcByteOffset, lineOfPixelData, rowCopyBytes);
-			write(destStartAddr + ((destY + Y) * destStride) + destByteOffset, lineOfPixelData, rowCopyBytes);
+		if(convert && !destBuffer[i].initialise(width, 1, destSurface.format)) {
+			return 2; // memory alloc failed
 		}
+	}
 
-		delete[] lineOfPixelData;
+	unsigned srcSize = srcBuffer[0].getStride();
+	unsigned destSize = width * destSurface.bytesPerPixel;
+	rasterWait(destWindow, SePos(destX, destY), SeSize(width, height), getTransferTime((srcSize + destSize) * height));
 
-	} else {
-		// Surface formats are different, so do a slow pixel-by-pixel copy.
-		//options are from RGB888 to RGB565 and vice-versa
-		SeColor color;
-
-		// Optimise DrawPixel by caching parameters on first call
-		bool newPixelDraw = true;
-
-		if(srcFormat == format_RGB_888) { //go RGB888 to RGB565
-			for(yCount = height, Y = yStart; yCount > 0; yCount--, Y += yInc) {
-				for(xCount = width, X = xStart; xCount > 0; xCount--, X += xInc) {
-					color = getPixel(srcWindow, area.x + X,
-									 area.y + Y); //get pixel value
-					color = ((color & 0x00F80000) >> 8) | ((color & 0x0000FC00) >> 5) |
-							((color & 0x000000F8) >> 3); //transform color
-					returnValue = drawPixel(destWindow, destX + X, destY + Y, color, newPixelDraw);
-					if(returnValue != 0) {
-						return returnValue;
-					}
-					newPixelDraw = false;
-				}
-			}
-		} else { //go RGB565 to RGB888
-			for(yCount = height, Y = yStart; yCount > 0; yCount--, Y += yInc) {
-				for(xCount = width, X = xStart; xCount > 0; xCount--, X += xInc) {
-					color = getPixel(srcWindow, area.x + X,
-									 area.y + Y); //get pixel value
-					color = ((color & 0x0000F800) << 8) | ((color & 0x0000E000) << 3) | ((color & 0x000007E0) << 5) |
-							((color & 0x00000600)) | ((color & 0x0000001F) << 3) |
-							((color & 0x0000001C) >> 2); //transform color
-					returnValue = drawPixel(destWindow, destX + X, destY + Y, color, newPixelDraw);
-					if(returnValue != 0) {
-						return returnValue;
-					}
-					newPixelDraw = false;
-				}
+	read(reqRd, srcSurface.getAddress(area.x, area.y + y), srcBuffer[0].getPtr(), srcSize);
+	for(unsigned i = 0; i < height; ++i, y += yInc) {
+		unsigned cur = i & 1;
+		wait(reqRd);
+		if(i + 1 < height) {
+			read(reqRd, srcSurface.getAddress(area.x, area.y + y + yInc), srcBuffer[cur ^ 1].getPtr(), srcSize);
+		}
+
+		void* data = srcBuffer[cur].getPtr();
+		if(convert) {
+			if(!convertPixels(destBuffer[cur].getPtr(), destSurface.format, data, srcSurface.format, width)) {
+				wait(reqRd);
+				return 3;
 			}
+			data = destBuffer[cur].getPtr();
 		}
+
+		// Requests complete in order, so the buffer written two rows ago is free once the previous write is done
+		wait(reqWr);
+		write(reqWr, destSurface.getAddress(destX, destY + y), data, destSize);
 	}
 
+	// Buffers must remain valid until the final write completes
+	wait(reqWr);
+
 	return 0;
 }
 
@@ -0,0 +1,117 @@
+/*
+ * GlyphAtlas.cpp
+ *
+ */
+
+#include "include/S1D13781/GlyphAtlas.h"
+#include <string.h>
+#include "BitBuffer.h"
+
+namespace S1D13781
+{
+bool GlyphAtlas::begin(uint8_t maxWidth, uint8_t maxHeight, uint16_t slotCount)
+{
+	end();
+
+	if(maxWidth == 0 || maxWidth > 32 || maxHeight == 0 || slotCount < 2) {
+		return false;
+	}
+
+	// Keep slot addresses word-aligned
+	uint16_t size = ((((maxWidth * maxHeight) + 7) / 8) + 3) & ~3;
+
+	slots = new Slot[slotCount]{};
+	if(slots == nullptr) {
+		return false;
+	}
+
+	baseAddress = heap.alloc(uint32_t(size) * slotCount);
+	if(baseAddress == VramHeap::invalid) {
+		delete[] slots;
+		slots = nullptr;
+		return false;
+	}
+
+	slotSize = size;
+	this->slotCount = slotCount;
+	useCounter = 0;
+	return true;
+}
+
+void GlyphAtlas::end()
+{
+	if(slots == nullptr) {
+		return;
+	}
+
+	heap.free(baseAddress);
+	baseAddress = invalid;
+	delete[] slots;
+	slots = nullptr;
+	slotSize = 0;
+	slotCount = 0;
+}
+
+void GlyphAtlas::invalidate(const SeFont* font)
+{
+	for(unsigned i = 0; i < slotCount; ++i) {
+		if(font == nullptr || slots[i].font == font) {
+			slots[i] = Slot{};
+		}
+	}
+}
+
+uint32_t GlyphAtlas::getGlyph(const SeFont& font, uint8_t ch, const SeCharOffset& offset, unsigned width)
+{
+	unsigned height = font.getHeight();
+	if(!canHold(width, height)) {
+		return invalid;
+	}
+
+	++useCounter;
+
+	// Look for glyph, tracking least recently used slot in case it's not there
+	unsigned lru = 0;
+	for(unsigned i = 0; i < slotCount; ++i) {
+		auto& slot = slots[i];
+		if(slot.font == &font && slot.ch == ch) {
+			slot.lastUse = useCounter;
+			++stats.hits;
+			return baseAddress + (i * slotSize);
+		}
+		if(slot.lastUse < slots[lru].lastUse) {
+			lru = i;
+		}
+	}
+
+	++stats.misses;
+	auto& slot = slots[lru];
+	if(slot.font != nullptr) {
+		++stats.evictions;
+	}
+
+	// Upload glyph bitmap
+	BitBuffer buffer;
+	if(!buffer.initialise(width, height)) {
+		slot = Slot{};
+		return invalid;
+	}
+	for(unsigned row = 0; row < height; ++row) {
+		uint32_t w = font.getGlyphBits(offset, row);
+		for(unsigned x = 0; x < width; ++x) {
+			buffer.setPixel(w & 0x80000000);
+			w <<= 1;
+		}
+	}
+
+	uint32_t addr = baseAddress + (lru * slotSize);
+	device.write(addr, buffer.getPtr(), buffer.getPos());
+	stats.uploadBytes += buffer.getPos();
+
+	slot.font = &font;
+	slot.ch = ch;
+	slot.lastUse = useCounter;
+	return addr;
+}
+
+} // namespace S1D13781
@@ -0,0 +1,103 @@
+/*
+ * PixelBatcher.cpp
+ *
+ */
+
+#include "include/S1D13781/PixelBatcher.h"
+
+namespace S1D13781
+{
+bool PixelBatcher::extends(int x, int y)
+{
+	switch(direction) {
+	case Direction::row:
+		return y == spanY && x == spanX + count;
+	case Direction::column:
+		return x == spanX && y == spanY + count;
+	case Direction::none:
+	default:
+		// Second pixel decides the direction
+		if(y == spanY && x == spanX + 1) {
+			direction = Direction::row;
+			return true;
+		}
+		if(x == spanX && y == spanY + 1) {
+			direction = Direction::column;
+			return true;
+		}
+		return false;
+	}
+}
+
+bool PixelBatcher::setPixel(int x, int y, SeColor color)
+{
+	if(!surface.contains(x, y)) {
+		return false;
+	}
+
+	if(count != 0 && (count == S1D13781_PIXEL_BATCH || !extends(x, y))) {
+		flush();
+	}
+
+	if(count == 0) {
+		spanX = x;
+		spanY = y;
+		spanColor = color;
+		uniform = true;
+		direction = Direction::none;
+	} else if(color.code != spanColor.code) {
+		uniform = false;
+	}
+
+	// Display memory is little-endian
+	auto ptr = &buffer[count * surface.bytesPerPixel];
+	ptr[0] = color.code;
+	if(surface.bytesPerPixel >= 2) {
+		ptr[1] = color.code >> 8;
+	}
+	if(surface.bytesPerPixel >= 3) {
+		ptr[2] = color.code >> 16;
+	}
+	++count;
+
+	return true;
+}
+
+SeColor PixelBatcher::getPixel(unsigned index) const
+{
+	auto ptr = &buffer[index * surface.bytesPerPixel];
+	uint32_t code = ptr[0];
+	if(surface.bytesPerPixel >= 2) {
+		code |= ptr[1] << 8;
+	}
+	if(surface.bytesPerPixel >= 3) {
+		code |= ptr[2] << 16;
+	}
+	return SeColor(code, surface.format);
+}
+
+void PixelBatcher::flush()
+{
+	if(count == 0) {
+		return;
+	}
+
+	uint32_t addr = surface.getAddress(spanX, spanY);
+	if(count == 1) {
+		driver.writeWord(addr, spanColor.code, surface.bytesPerPixel);
+	} else if(uniform && count >= S1D13781_PIXEL_BATCH_FILL) {
+		SeSize size = (direction == Direction::row) ? SeSize(count, 1) : SeSize(1, count);
+		driver.bltSolidFill(window, SePos(spanX, spanY), size, spanColor);
+	} else if(direction == Direction::row) {
+		driver.write(addr, buffer, count * surface.bytesPerPixel);
+	} else {
+		for(unsigned i = 0; i < count; ++i) {
+			driver.writeWord(addr, getPixel(i).code, surface.bytesPerPixel);
+			addr += surface.stride;
+		}
+	}
+
+	count = 0;
+}
+
+} // namespace S1D13781
@@ -3,6 +3,9 @@
 
 #include "include/S1D13781/SeColor.h"
 #include <debug_progmem.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
 
 class PixelBuffer
 {
@@ -97,8 +100,14 @@ public:
 	void fill(SeColor color)
 	{
 		unsigned size = getSize();
-		for(unsigned offset = 0; offset < size; offset += bytesPerPixel) {
-			setPixel(offset, color);
+		if(size == 0) {
+			return;
+		}
+
+		// Set the first pixel then keep doubling
+		setPixel(0U, color);
+		for(unsigned done = bytesPerPixel; done < size; done *= 2) {
+			memcpy(&buffer[done], buffer, std::min(done, size - done));
 		}
 	}
 
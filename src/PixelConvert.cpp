@@ -0,0 +1,247 @@
+/*
+ * PixelConvert.cpp
+ *
+ */
+
+#include "include/S1D13781/PixelConvert.h"
+#include <string.h>
+
+namespace S1D13781
+{
+namespace
+{
+/*
+ * Channel expansion, 255 * value / max, as used by RGBColor::set()
+ */
+template <unsigned bits> struct ExpandTable {
+	uint8_t value[1U << bits];
+
+	constexpr ExpandTable() : value()
+	{
+		for(unsigned i = 0; i < (1U << bits); ++i) {
+			value[i] = 255 * i / ((1U << bits) - 1);
+		}
+	}
+
+	uint8_t operator[](unsigned index) const
+	{
+		return value[index];
+	}
+};
+
+constexpr ExpandTable<2> expand2;
+constexpr ExpandTable<3> expand3;
+constexpr ExpandTable<5> expand5;
+constexpr ExpandTable<6> expand6;
+
+/*
+ * Channel reduction, value * max / 255, as used by RGBColor::getColor().
+ * Two channels are packed into 16-bit lanes of a word and divided together (see divide255()).
+ */
+uint32_t reducePair(unsigned hi, unsigned lo, unsigned max)
+{
+	uint32_t x = ((hi << 16) | lo) * max;
+	return ((x + 0x00010001U + ((x >> 8) & 0x00FF00FFU)) >> 8) & 0x00FF00FFU;
+}
+
+/*
+ * Pixel layouts. Sources decode to 8-bit channels, destinations encode from them.
+ */
+struct Bgr888 {
+	static constexpr unsigned size = 3;
+
+	static void get(const uint8_t* ptr, unsigned& r, unsigned& g, unsigned& b)
+	{
+		b = ptr[0];
+		g = ptr[1];
+		r = ptr[2];
+	}
+
+	static uint32_t encode(unsigned r, unsigned g, unsigned b)
+	{
+		return b | (g << 8) | (r << 16);
+	}
+
+	static void set(uint8_t* ptr, unsigned r, unsigned g, unsigned b)
+	{
+		ptr[0] = b;
+		ptr[1] = g;
+		ptr[2] = r;
+	}
+};
+
+// Image data is stored as R, G, B
+struct Rgb888 {
+	static constexpr unsigned size = 3;
+
+	static void get(const uint8_t* ptr, unsigned& r, unsigned& g, unsigned& b)
+	{
+		r = ptr[0];
+		g = ptr[1];
+		b = ptr[2];
+	}
+};
+
+struct Rgb565 {
+	static constexpr unsigned size = 2;
+
+	static void get(const uint8_t* ptr, unsigned& r, unsigned& g, unsigned& b)
+	{
+		unsigned code = ptr[0] | (ptr[1] << 8);
+		r = expand5[code >> 11];
+		g = expand6[(code >> 5) & 0x3f];
+		b = expand5[code & 0x1f];
+	}
+
+	static uint32_t encode(unsigned r, unsigned g, unsigned b)
+	{
+		uint32_t rb = reducePair(r, b, 31);
+		return ((rb >> 5) & 0xf800) | (divide255(g * 63) << 5) | (rb & 0x1f);
+	}
+
+	static void set(uint8_t* ptr, unsigned r, unsigned g, unsigned b)
+	{
+		auto code = encode(r, g, b);
+		ptr[0] = code;
+		ptr[1] = code >> 8;
+	}
+};
+
+struct Rgb332 {
+	static constexpr unsigned size = 1;
+
+	static void get(const uint8_t* ptr, unsigned& r, unsigned& g, unsigned& b)
+	{
+		unsigned code = ptr[0];
+		r = expand3[code >> 5];
+		g = expand3[(code >> 2) & 0x07];
+		b = expand2[code & 0x03];
+	}
+
+	static uint32_t encode(unsigned r, unsigned g, unsigned b)
+	{
+		uint32_t rg = reducePair(r, g, 7);
+		return ((rg >> 11) & 0xe0) | ((rg & 0x07) << 2) | divide255(b * 3);
+	}
+
+	static void set(uint8_t* ptr, unsigned r, unsigned g, unsigned b)
+	{
+		ptr[0] = encode(r, g, b);
+	}
+};
+
+template <class Src, class Dst> void convertRow(uint8_t* dst, const uint8_t* src, unsigned count)
+{
+	for(; count != 0; --count) {
+		unsigned r, g, b;
+		Src::get(src, r, g, b);
+		Dst::set(dst, r, g, b);
+		src += Src::size;
+		dst += Dst::size;
+	}
+}
+
+/*
+ * 24-bit sources packed to 16 or 8 bits four pixels at a time, reading three words and writing one or two.
+ * Display memory and supported hosts are little-endian.
+ */
+template <class Src, class Dst> void packRow(uint8_t* dst, const uint8_t* src, unsigned count)
+{
+	// Channels are given in memory order
+	auto encode = [](unsigned c0, unsigned c1, unsigned c2) -> uint32_t {
+		unsigned r, g, b;
+		const uint8_t bytes[3]{uint8_t(c0), uint8_t(c1), uint8_t(c2)};
+		Src::get(bytes, r, g, b);
+		return Dst::encode(r, g, b);
+	};
+
+	for(; count >= 4; count -= 4) {
+		uint32_t w[3];
+		memcpy(w, src, sizeof(w));
+		uint32_t p0 = encode(w[0] & 0xff, (w[0] >> 8) & 0xff, (w[0] >> 16) & 0xff);
+		uint32_t p1 = encode(w[0] >> 24, w[1] & 0xff, (w[1] >> 8) & 0xff);
+		uint32_t p2 = encode((w[1] >> 16) & 0xff, w[1] >> 24, w[2] & 0xff);
+		uint32_t p3 = encode((w[2] >> 8) & 0xff, (w[2] >> 16) & 0xff, w[2] >> 24);
+		if(Dst::size == 2) {
+			const uint32_t out[2]{p0 | (p1 << 16), p2 | (p3 << 16)};
+			memcpy(dst, out, sizeof(out));
+		} else {
+			uint32_t out = p0 | (p1 << 8) | (p2 << 16) | (p3 << 24);
+			memcpy(dst, &out, sizeof(out));
+		}
+		src += 4 * Src::size;
+		dst += 4 * Dst::size;
+	}
+
+	convertRow<Src, Dst>(dst, src, count);
+}
+
+using RowConverter = void (*)(uint8_t* dst, const uint8_t* src, unsigned count);
+
+enum Layout {
+	layout888,
+	layout565,
+	layout332,
+	layoutRgb, ///< Image data, source only
+	layoutInvalid,
+};
+
+const uint8_t layoutSizes[layoutInvalid]{3, 2, 1, 3};
+
+// Indexed by [source][destination]; identical layouts are copied directly
+const RowConverter converters[layoutInvalid][layoutRgb]{
+	{nullptr, packRow<Bgr888, Rgb565>, packRow<Bgr888, Rgb332>},
+	{convertRow<Rgb565, Bgr888>, nullptr, convertRow<Rgb565, Rgb332>},
+	{convertRow<Rgb332, Bgr888>, convertRow<Rgb332, Rgb565>, nullptr},
+	{convertRow<Rgb888, Bgr888>, packRow<Rgb888, Rgb565>, packRow<Rgb888, Rgb332>},
+};
+
+Layout getLayout(ImageDataFormat format)
+{
+	switch(format) {
+	case format_RGB_888:
+	case format_RGB_888LUT:
+		return layout888;
+	case format_RGB_565:
+	case format_RGB_565LUT:
+		return layout565;
+	case format_RGB_332LUT:
+		return layout332;
+	default:
+		return layoutInvalid;
+	}
+}
+
+bool convert(uint8_t* dst, Layout dstLayout, const uint8_t* src, Layout srcLayout, unsigned count)
+{
+	if(srcLayout == layoutInvalid || dstLayout >= layoutRgb) {
+		return false;
+	}
+
+	auto converter = converters[srcLayout][dstLayout];
+	if(converter == nullptr) {
+		if(dst != src) {
+			memmove(dst, src, count * layoutSizes[dstLayout]);
+		}
+		return true;
+	}
+
+	converter(dst, src, count);
+	return true;
+}
+
+} // namespace
+
+bool convertPixels(void* dst, ImageDataFormat dstFormat, const void* src, ImageDataFormat srcFormat, unsigned count)
+{
+	return convert(static_cast<uint8_t*>(dst), getLayout(dstFormat), static_cast<const uint8_t*>(src),
+				   getLayout(srcFormat), count);
+}
+
+bool convertImagePixels(void* dst, ImageDataFormat dstFormat, const void* src, unsigned count)
+{
+	return convert(static_cast<uint8_t*>(dst), getLayout(dstFormat), static_cast<const uint8_t*>(src), layoutRgb,
+				   count);
+}
+
+} // namespace S1D13781
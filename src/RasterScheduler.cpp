@@ -0,0 +1,52 @@
+/*
+ * RasterScheduler.cpp
+ *
+ */
+
+#include "include/S1D13781/RasterScheduler.h"
+
+namespace S1D13781
+{
+uint32_t RasterScheduler::getDelay(uint16_t line, uint16_t first, uint16_t last, uint32_t duration) const
+{
+	if(first > last || totalLines == 0) {
+		return 0;
+	}
+
+	uint32_t durationLines = ((1000ULL * duration) + lineInterval - 1) / lineInterval;
+
+	// Update spans so much of the frame that waiting cannot help
+	if(durationLines + (last - first) >= totalLines) {
+		return 0;
+	}
+
+	// Region ahead of the scan, with time to complete before it's reached
+	if(first > line && uint32_t(first - line) > durationLines) {
+		return 0;
+	}
+
+	// Region behind the scan, with time to complete before it returns in the next frame
+	if(last < line && uint32_t(totalLines - line + first) > durationLines) {
+		return 0;
+	}
+
+	// Wait until the scan has passed the last affected line
+	uint32_t lines = (last >= line) ? (last - line + 1) : (totalLines - line + last + 1);
+	return uint64_t(lines) * lineInterval / 1000U;
+}
+
+void RasterScheduler::checked(uint32_t delay)
+{
+	++stats.checks;
+	if(delay == 0) {
+		return;
+	}
+
+	++stats.deferred;
+	stats.deferredTime += delay;
+	if(delay > stats.maxDeferral) {
+		stats.maxDeferral = delay;
+	}
+}
+
+} // namespace S1D13781
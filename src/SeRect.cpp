@@ -0,0 +1,120 @@
+/*
+ * SeRect.cpp
+ *
+ */
+
+#include "include/S1D13781/SeRect.h"
+#include <stdlib.h>
+
+namespace S1D13781
+{
+namespace
+{
+enum OutCode {
+	outLeft = 0x01,
+	outRight = 0x02,
+	outTop = 0x04,
+	outBottom = 0x08,
+};
+
+struct ClipBounds {
+	int left;
+	int top;
+	int right;
+	int bottom;
+
+	unsigned getOutCode(int x, int y) const
+	{
+		unsigned code = 0;
+		if(x < left) {
+			code |= outLeft;
+		} else if(x > right) {
+			code |= outRight;
+		}
+		if(y < top) {
+			code |= outTop;
+		} else if(y > bottom) {
+			code |= outBottom;
+		}
+		return code;
+	}
+};
+
+/*
+ * Calculate a * b / c rounded to nearest.
+ * Display coordinates are small enough that 32-bit products almost always suffice.
+ */
+int mulDiv(int a, int b, int c)
+{
+	if(c < 0) {
+		a = -a;
+		c = -c;
+	}
+	if(abs(a) < 0x8000 && abs(b) < 0x8000) {
+		int num = a * b;
+		return (num < 0 ? num - c / 2 : num + c / 2) / c;
+	}
+	int64_t num = int64_t(a) * b;
+	return (num < 0 ? num - c / 2 : num + c / 2) / c;
+}
+
+} // namespace
+
+bool clipLine(int& x1, int& y1, int& x2, int& y2, const SeRect& clip)
+{
+	if(clip.isEmpty()) {
+		return false;
+	}
+
+	ClipBounds bounds{clip.x, clip.y, clip.x2() - 1, clip.y2() - 1};
+
+	// Intersections are always calculated from the original line to avoid accumulating rounding errors
+	const int ox = x1;
+	const int oy = y1;
+	const int dx = x2 - x1;
+	const int dy = y2 - y1;
+
+	unsigned code1 = bounds.getOutCode(x1, y1);
+	unsigned code2 = bounds.getOutCode(x2, y2);
+
+	for(;;) {
+		// Both ends inside
+		if((code1 | code2) == 0) {
+			return true;
+		}
+
+		// Both ends beyond the same edge
+		if((code1 & code2) != 0) {
+			return false;
+		}
+
+		// Move an outside end point onto the edge it lies beyond
+		unsigned code = code1 ? code1 : code2;
+		int x, y;
+		if(code & outTop) {
+			x = ox + mulDiv(dx, bounds.top - oy, dy);
+			y = bounds.top;
+		} else if(code & outBottom) {
+			x = ox + mulDiv(dx, bounds.bottom - oy, dy);
+			y = bounds.bottom;
+		} else if(code & outLeft) {
+			y = oy + mulDiv(dy, bounds.left - ox, dx);
+			x = bounds.left;
+		} else {
+			y = oy + mulDiv(dy, bounds.right - ox, dx);
+			x = bounds.right;
+		}
+
+		if(code == code1) {
+			x1 = x;
+			y1 = y;
+			code1 = bounds.getOutCode(x1, y1);
+		} else {
+			x2 = x;
+			y2 = y;
+			code2 = bounds.getOutCode(x2, y2);
+		}
+	}
+}
+
+} // namespace S1D13781
@@ -0,0 +1,212 @@
+/*
+ * VramHeap.cpp
+ *
+ */
+
+#include "include/S1D13781/VramHeap.h"
+#include <debug_progmem.h>
+#include <string.h>
+
+namespace S1D13781
+{
+void VramHeap::initialise(uint32_t size)
+{
+	blocks[0] = Block{0, size, false, false};
+	blockCount = 1;
+	allocFailures = 0;
+	guardFailures = 0;
+}
+
+int VramHeap::find(Address address) const
+{
+	for(unsigned i = 0; i < blockCount; ++i) {
+		if(blocks[i].address == address) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool VramHeap::split(unsigned index, Address address, uint32_t size)
+{
+	auto block = blocks[index];
+	Address end = address + size;
+	Address blockEnd = block.address + block.size;
+	bool head = address > block.address;
+	bool tail = end < blockEnd;
+	unsigned extra = unsigned(head) + unsigned(tail);
+	if(blockCount + extra > maxBlocks) {
+		return false;
+	}
+
+	// Make room for new entries following the one being split
+	memmove(&blocks[index + 1 + extra], &blocks[index + 1], (blockCount - index - 1) * sizeof(Block));
+	blockCount += extra;
+
+	if(head) {
+		blocks[index++] = Block{block.address, address - block.address, false, false};
+	}
+	blocks[index] = Block{address, size, true, false};
+	if(tail) {
+		blocks[index + 1] = Block{end, blockEnd - end, false, false};
+	}
+
+	return true;
+}
+
+void VramHeap::merge(unsigned index)
+{
+	// Absorb following free block
+	if(index + 1 < blockCount && !blocks[index + 1].used) {
+		blocks[index].size += blocks[index + 1].size;
+		memmove(&blocks[index + 1], &blocks[index + 2], (blockCount - index - 2) * sizeof(Block));
+		--blockCount;
+	}
+
+	// Merge into preceding free block
+	if(index > 0 && !blocks[index - 1].used) {
+		blocks[index - 1].size += blocks[index].size;
+		memmove(&blocks[index], &blocks[index + 1], (blockCount - index - 1) * sizeof(Block));
+		--blockCount;
+	}
+}
+
+bool VramHeap::reserve(Address address, uint32_t size)
+{
+	if(size != 0) {
+		for(unsigned i = 0; i < blockCount; ++i) {
+			auto& block = blocks[i];
+			if(block.used || address < block.address) {
+				continue;
+			}
+			if(address + size > block.address + block.size) {
+				continue;
+			}
+			if(split(i, address, size)) {
+				return true;
+			}
+			break;
+		}
+	}
+
+	debug_w("[VRAM] Reserve 0x%06x, %u failed", address, size);
+	++allocFailures;
+	return false;
+}
+
+VramHeap::Address VramHeap::alloc(uint32_t size, unsigned alignment)
+{
+	if(size == 0 || alignment == 0 || (alignment & (alignment - 1)) != 0) {
+		++allocFailures;
+		return invalid;
+	}
+
+	// Best fit: the smallest free block which can hold the aligned request
+	uint32_t required = size + guardSize;
+	int best = -1;
+	Address bestAddress = invalid;
+	for(unsigned i = 0; i < blockCount; ++i) {
+		auto& block = blocks[i];
+		if(block.used) {
+			continue;
+		}
+		Address address = (block.address + alignment - 1) & ~(alignment - 1);
+		if(address + required > block.address + block.size) {
+			continue;
+		}
+		if(best < 0 || block.size < blocks[best].size) {
+			best = i;
+			bestAddress = address;
+		}
+	}
+
+	if(best < 0 || !split(best, bestAddress, required)) {
+		++allocFailures;
+		return invalid;
+	}
+
+	auto& block = blocks[find(bestAddress)];
+	block.guarded = true;
+	uint32_t guard = guardValue;
+	device.write(bestAddress + size, &guard, guardSize);
+
+	return bestAddress;
+}
+
+bool VramHeap::free(Address address)
+{
+	int i = find(address);
+	if(i < 0 || !blocks[i].used) {
+		debug_e("[VRAM] Invalid free 0x%06x", address);
+		return false;
+	}
+
+	auto& block = blocks[i];
+	if(block.guarded) {
+		checkGuard(block);
+	}
+	block.used = false;
+	block.guarded = false;
+	merge(i);
+	return true;
+}
+
+uint32_t VramHeap::getSize(Address address) const
+{
+	int i = find(address);
+	if(i < 0 || !blocks[i].used) {
+		return 0;
+	}
+	auto& block = blocks[i];
+	return block.guarded ? block.size - guardSize : block.size;
+}
+
+bool VramHeap::checkGuard(const Block& block)
+{
+	Address guardAddress = block.address + block.size - guardSize;
+	uint32_t guard = device.readWord(guardAddress, guardSize);
+	if(guard == guardValue) {
+		return true;
+	}
+
+	debug_e("[VRAM] Guard corrupted at 0x%06x: 0x%08x", guardAddress, guard);
+	++guardFailures;
+	return false;
+}
+
+bool VramHeap::check()
+{
+	bool ok = true;
+	for(unsigned i = 0; i < blockCount; ++i) {
+		auto& block = blocks[i];
+		if(block.guarded && !checkGuard(block)) {
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+VramHeap::Stats VramHeap::getStats() const
+{
+	Stats stats{};
+	for(unsigned i = 0; i < blockCount; ++i) {
+		auto& block = blocks[i];
+		stats.size += block.size;
+		if(block.used) {
+			stats.used += block.size;
+			++stats.usedBlocks;
+		} else {
+			stats.free += block.size;
+			++stats.freeBlocks;
+			if(block.size > stats.largestFree) {
+				stats.largestFree = block.size;
+			}
+		}
+	}
+	stats.largestFree = (stats.largestFree > guardSize) ? stats.largestFree - guardSize : 0;
+	stats.allocFailures = allocFailures;
+	stats.guardFailures = guardFailures;
+	return stats;
+}
+
+} // namespace S1D13781
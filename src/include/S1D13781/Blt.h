@@ -0,0 +1,41 @@
+/*
+ * Blt.h
+ *
+ * Definitions for the S1D13781 BitBLT engine
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace S1D13781
+{
+enum class BltCmd : uint16_t {
+	movePositive, ///< Copy rectangular area in VRAM, new address > old address
+	moveNegative, ///< Copy rectangular area in VRAM, new address < old address
+	solidFill,	///< Fill rectangular area
+	reserved03,
+	moveExpand, ///< Copy area bits expanding to current foreground/background colours
+};
+
+#pragma pack(1)
+/** @brief Register layout for BLT operations so we can use burst write
+ *  @note Starts at REG80_BLT_CTRL_0
+ */
+struct __attribute__((packed)) SeBltParam {
+	uint16_t ctrl0;
+	uint16_t ctrl1;
+	uint16_t status;
+	BltCmd cmd;
+	uint32_t ssAddr;
+	uint32_t dsAddr;
+	uint16_t rectOffset;
+	uint16_t width;
+	uint16_t height;
+	uint32_t bgColor;
+	uint32_t fgColor;
+};
+#pragma pack()
+
+} // namespace S1D13781
@@ -0,0 +1,105 @@
+/*
+ * BltScheduler.h
+ *
+ * Predicts BLT engine completion so the status register need only be polled when it's likely to be idle
+ *
+ */
+
+#pragma once
+
+#include "Blt.h"
+
+namespace S1D13781
+{
+class BltScheduler
+{
+public:
+	/** @brief Accumulated prediction statistics
+	 *  @note Actual busy time is only known when the engine was found busy at the predicted time,
+	 *  or when calibrating. `predictedTime` and `actualTime` cover only those measured operations.
+	 */
+	struct Stats {
+		uint32_t count;			 ///< Number of BLT operations started
+		uint32_t polls;			 ///< Number of status register reads
+		uint32_t measured;		 ///< Number of operations with a measured busy time
+		uint32_t underestimates; ///< Engine still busy at predicted completion time
+		uint32_t predictedTime;  ///< Predicted busy time of measured operations, in microseconds
+		uint32_t actualTime;	 ///< Measured busy time, in microseconds
+
+		void clear()
+		{
+			*this = Stats{};
+		}
+	};
+
+	/** @brief Model parameters
+	 *  @note Costs are in MCLK cycles per byte of VRAM traffic, in 1/16ths
+	 */
+	struct Model {
+		uint16_t overheadCycles = 32;
+		uint8_t fillCost = 16;
+		uint8_t moveCost = 32;
+		uint8_t expandCost = 20;
+	};
+
+	void setClock(uint32_t mclk)
+	{
+		mclkMHz = (mclk < 1000000U) ? 1 : mclk / 1000000U;
+	}
+
+	/** @brief Estimate duration of a BLT operation
+	 *  @retval uint32_t Time in microseconds
+	 */
+	uint32_t estimate(const SeBltParam& blt) const;
+
+	/** @brief Record start of a BLT operation */
+	void started(const SeBltParam& blt);
+
+	/** @brief Get time until the current BLT is predicted to complete
+	 *  @retval uint32_t Time in microseconds, 0 if predicted idle
+	 */
+	uint32_t getRemaining() const;
+
+	/** @brief Record result of reading the BLT status register */
+	void polled(bool busy);
+
+	/** @brief In calibration mode the status is polled immediately after every BLT starts
+	 *  so that actual busy time is recorded for every operation.
+	 */
+	void setCalibrate(bool enable)
+	{
+		calibrate = enable;
+	}
+
+	bool isCalibrating() const
+	{
+		return calibrate;
+	}
+
+	Model& getModel()
+	{
+		return model;
+	}
+
+	const Stats& getStats() const
+	{
+		return stats;
+	}
+
+	void clearStats()
+	{
+		stats.clear();
+	}
+
+private:
+	Model model;
+	Stats stats{};
+	uint32_t mclkMHz{1};
+	uint32_t startTime{0};
+	uint32_t predicted{0};
+	bool active{false};
+	bool wasBusy{false};
+	bool calibrate{false};
+};
+
+} // namespace S1D13781
@@ -0,0 +1,110 @@
+/*
+ * CommandQueue.h
+ *
+ * Bounded ring buffer of drawing commands for asynchronous execution
+ *
+ */
+
+#pragma once
+
+#include "Blt.h"
+#include <stddef.h>
+
+#ifndef S1D13781_COMMAND_QUEUE_SIZE
+#define S1D13781_COMMAND_QUEUE_SIZE 16
+#endif
+
+namespace S1D13781
+{
+/** @brief A single queued operation
+ *  @note BLT parameters are fully resolved when the command is queued
+ */
+struct Command {
+	enum class Kind : uint8_t {
+		blt,   ///< Execute a BLT operation using `blt`
+		write, ///< Burst write `length` bytes from `data` to `address`
+	};
+
+	Kind kind;
+	uint16_t length;
+	uint32_t address;
+	const void* data;
+	SeBltParam blt;
+};
+
+/** @brief Fixed-size queue of commands
+ *
+ * Commands are identified by a sequence number, returned as a `Fence` when queued.
+ * A fence is complete once the corresponding command, and all those before it, have executed.
+ */
+class CommandQueue
+{
+public:
+	using Fence = uint32_t;
+
+	static constexpr unsigned size = S1D13781_COMMAND_QUEUE_SIZE;
+	static_assert((size & (size - 1)) == 0, "Command queue size must be a power of 2");
+
+	bool isEmpty() const
+	{
+		return head == tail;
+	}
+
+	bool isFull() const
+	{
+		return head - tail >= size;
+	}
+
+	unsigned count() const
+	{
+		return head - tail;
+	}
+
+	/** @brief Get the next free slot
+	 *  @retval Command* nullptr if queue is full
+	 */
+	Command* reserve()
+	{
+		return isFull() ? nullptr : &commands[head % size];
+	}
+
+	/** @brief Add the previously reserved command to the queue
+	 *  @retval Fence Token to check for completion
+	 */
+	Fence commit()
+	{
+		return ++head;
+	}
+
+	/** @brief Get the command at the front of the queue
+	 *  @retval Command* nullptr if queue is empty
+	 */
+	Command* peek()
+	{
+		return isEmpty() ? nullptr : &commands[tail % size];
+	}
+
+	/** @brief Remove completed command from front of queue */
+	void pop()
+	{
+		++tail;
+	}
+
+	bool isComplete(Fence fence) const
+	{
+		return int32_t(tail - fence) >= 0;
+	}
+
+	/** @brief Get fence for the most recently queued command */
+	Fence getLastFence() const
+	{
+		return head;
+	}
+
+private:
+	Command commands[size];
+	uint32_t head{0}; ///< Sequence number of last queued command
+	uint32_t tail{0}; ///< Sequence number of last completed command
+};
+
+} // namespace S1D13781
@@ -0,0 +1,127 @@
+/*
+ * DamageTracker.h
+ *
+ * Records which areas of a window have been modified
+ *
+ */
+
+#pragma once
+
+#include "SeRect.h"
+
+#ifndef S1D13781_DAMAGE_RECTS
+#define S1D13781_DAMAGE_RECTS 16
+#endif
+
+namespace S1D13781
+{
+/** @brief Maintains a bounded list of modified (damaged) rectangles
+ *
+ * Each reported rectangle is merged with an existing one if the combined bounding rectangle
+ * doesn't add too much undamaged area. This is set by the overdraw threshold: for example, with
+ * the default of 25% two rectangles are merged if their union is no more than 1.25 times their
+ * combined area.
+ *
+ * When the list is full the pair which adds the least area when merged are combined.
+ */
+class DamageTracker
+{
+public:
+	static constexpr unsigned maxRects = S1D13781_DAMAGE_RECTS;
+
+	struct Stats {
+		uint32_t reported; ///< Number of rectangles added
+		uint32_t merged;   ///< Number of merge operations
+		uint32_t frames;   ///< Number of times damage was flushed or cleared
+		uint32_t damagedBytes; ///< Total size of damaged areas when flushed or cleared
+		uint32_t fullBytes;	///< Size of the window multiplied by frame count
+
+		/** @brief Bytes not written compared with redrawing the full window each frame */
+		uint32_t savedBytes() const
+		{
+			return (fullBytes > damagedBytes) ? fullBytes - damagedBytes : 0;
+		}
+
+		void clear()
+		{
+			*this = Stats{};
+		}
+	};
+
+	/** @brief Set the area being tracked; damage outside this is ignored */
+	void setBounds(const SeRect& bounds)
+	{
+		this->bounds = bounds;
+		rectCount = 0;
+	}
+
+	const SeRect& getBounds() const
+	{
+		return bounds;
+	}
+
+	/** @brief Set the permitted overdraw when merging rectangles, as a percentage */
+	void setThreshold(uint8_t percent)
+	{
+		threshold = percent;
+	}
+
+	/** @brief Record a damaged area */
+	void add(SeRect rect);
+
+	bool isEmpty() const
+	{
+		return rectCount == 0;
+	}
+
+	unsigned count() const
+	{
+		return rectCount;
+	}
+
+	const SeRect& operator[](unsigned index) const
+	{
+		return rects[index];
+	}
+
+	const SeRect* begin() const
+	{
+		return rects;
+	}
+
+	const SeRect* end() const
+	{
+		return rects + rectCount;
+	}
+
+	/** @brief Get total area of the damaged rectangles, in pixels */
+	uint32_t area() const;
+
+	/** @brief Discard damage list, updating statistics
+	 *  @param bytesPerPixel Used to calculate byte counts
+	 */
+	void clear(uint8_t bytesPerPixel);
+
+	const Stats& getStats() const
+	{
+		return stats;
+	}
+
+	void clearStats()
+	{
+		stats.clear();
+	}
+
+private:
+	bool canMerge(const SeRect& r1, const SeRect& r2) const;
+	void remove(unsigned index);
+
+	SeRect bounds;
+	SeRect rects[maxRects];
+	uint8_t rectCount{0};
+	uint8_t threshold{25};
+	uint8_t lastIndex{0}; ///< Most recently modified entry, checked first
+	Stats stats{};
+};
+
+} // namespace S1D13781
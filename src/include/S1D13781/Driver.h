@@ -19,7 +19,13 @@
 
 #include <HSPI/MemoryDevice.h>
 #include "SeColor.h"
+#include "Blt.h"
+#include "CommandQueue.h"
+#include "BltScheduler.h"
+#include "VramHeap.h"
+#include "RasterScheduler.h"
 
+const uint32_t S1D13781_VRAM_SIZE = 0x060000;
 const uint32_t S1D13781_LUT1_BASE = 0x060000;
 const uint32_t S1D13781_LUT2_BASE = 0x060400;
 const uint32_t S1D13781_REG_BASE = 0x060800;
@@ -84,6 +90,8 @@ union SeSize {
 
 namespace S1D13781
 {
+struct ShadowRegisters;
+
 /** @brief Defines various clock parameters */
 struct S1DTiming {
 	uint8_t nCounter;
@@ -93,6 +101,9 @@ struct S1DTiming {
 	uint32_t mclk;
 	uint32_t pclk;
 	uint32_t frameInterval; // Time in microseconds between frames, fps = 1e6 / interval
+	uint32_t lineInterval;  // Time in nanoseconds per line, including non-display period
+	uint16_t displayLines;  // VDISP: number of visible lines
+	uint16_t totalLines;	// VDISP + VNDP
 };
 
 //possible destination windows
@@ -122,12 +133,44 @@ enum class PipEffect {
 	continuous,
 };
 
-enum class BltCmd : uint16_t {
-	movePositive, ///< Copy rectangular area in VRAM, new address > old address
-	moveNegative, ///< Copy rectangular area in VRAM, new address < old address
-	solidFill,	///< Fill rectangular area
-	reserved03,
-	moveExpand, ///< Copy area bits expanding to current foreground/background colours
+/** @brief Drawing parameters for a window, derived from register settings
+ *  @note Kept up to date by the Driver so hot paths need not re-read (and re-decode) the register cache
+ */
+struct Surface {
+	using ColorConverter = SeColor (*)(SeColor color);
+
+	uint32_t startAddress;   ///< VRAM address of top-left pixel
+	uint16_t stride;		 ///< Bytes per line
+	uint8_t bytesPerPixel;   ///< 0 for an invalid window
+	ImageDataFormat format;  ///< Colour depth
+	uint16_t rotation;		 ///< Counter-clockwise rotation in degrees
+	SeSize size;			 ///< Drawing dimensions, accounting for rotation
+	ColorConverter converter; ///< Maps an RGB colour to the surface format
+
+	bool isValid() const
+	{
+		return bytesPerPixel != 0;
+	}
+
+	uint32_t getAddress(uint16_t x, uint16_t y) const
+	{
+		return startAddress + (y * stride) + (x * bytesPerPixel);
+	}
+
+	uint32_t getAddress(SePos pos) const
+	{
+		return getAddress(pos.x, pos.y);
+	}
+
+	bool contains(int x, int y) const
+	{
+		return x >= 0 && y >= 0 && x < size.width && y < size.height;
+	}
+
+	SeColor lookupColor(SeColor color) const
+	{
+		return converter(color);
+	}
 };
 
 //base class with hardware accessor functions
@@ -238,6 +281,38 @@ public:
 	 */
 	uint16_t regClearBits(uint8_t regIndex, uint16_t clearBits);
 
+	/** @brief Defer register writes
+	 *  @note
+	 * Writes to shadowed registers are held until the matching call to endUpdate(),
+	 * then contiguous runs of modified registers are written as single burst transfers.
+	 * Calls may be nested.
+	 */
+	void beginUpdate()
+	{
+		++updateLevel;
+	}
+
+	/** @brief Complete a deferred update, calling commit() for the outermost level */
+	void endUpdate();
+
+	/** @brief Write all modified (dirty) shadow registers to the hardware */
+	void commit();
+
+	/** @brief Get the drawing parameters for a window
+	 *  @note The returned reference remains valid but its contents are updated if window registers are changed
+	 */
+	const Surface& getSurface(Window window)
+	{
+		auto i = unsigned(window);
+		if(i >= ARRAY_SIZE(surfaces)) {
+			return invalidSurface;
+		}
+		if(!(surfaceValid & BIT(i))) {
+			updateSurface(window);
+		}
+		return surfaces[i];
+	}
+
 	/** @brief Set the rotation of the main layer.
 	 *
 	 * param	rotationDegrees		Counter-clockwise rotation of the main layer in degrees.
@@ -272,7 +347,7 @@ public:
 	 */
 	uint8_t getBytesPerPixel(Window window)
 	{
-		return ::getBytesPerPixel(getColorDepth(window));
+		return getSurface(window).bytesPerPixel;
 	}
 
 	/** @brief Set the video memory start address for a window
@@ -289,7 +364,11 @@ public:
 	 *
 	*/
 	uint32_t getStartAddress(Window window);
-	uint32_t getAddress(Window window, uint16_t x, uint16_t y);
+	uint32_t getAddress(Window window, uint16_t x, uint16_t y)
+	{
+		auto& surface = getSurface(window);
+		return surface.isValid() ? surface.getAddress(x, y) : 0xFFFFFFFF;
+	}
 	uint32_t getAddress(Window window, SePos pos)
 	{
 		return getAddress(window, pos.x, pos.y);
@@ -562,6 +641,11 @@ public:
 	*/
 	void pipSetupWindow(uint16_t xPos, uint16_t yPos, uint16_t pipWidth, uint16_t pipHeight);
 
+	/** @brief Set fade rate, alpha blend step and ratio for the PIP window in a single transfer
+	 *  @see pipSetFadeRate(), pipSetAlphaBlendStep(), pipSetAphaBlendRatio()
+	 */
+	void pipSetupFade(uint8_t fadeRate, uint8_t step, uint8_t ratio);
+
 	//lut functions
 
 	/** @brief Set a specific LUT entry
@@ -638,13 +722,22 @@ public:
 		 * @todo For LUT modes this should reflect the inverse mapping of setLutDefault().
 		 * Dealing with custom mappings is a bit trickier.
 		 */
-		return RGBColor(color).getColor(getColorDepth(window));
+		return getSurface(window).lookupColor(color);
 	}
 
 	bool bltSolidFill(Window window, SePos pos, SeSize size, SeColor color);
 	bool bltMoveExpand(Window window, uint32_t srcAddr, SePos dstPos, SeSize dstSize, SeColor fgColor, SeColor bgColor);
 	bool bltMove(Window window, BltCmd cmd, SePos srcPos, SePos dstPos, SeSize size);
 
+	/** @brief Move an area between windows with the same colour depth
+	 *  @retval bool false if a window is invalid, the colour depths differ, or a buffered copy runs out of memory
+	 *  @note The BLT engine has a single rectangle offset register, so if the window strides differ
+	 *  each row is moved separately. Direction is chosen by comparing display memory addresses
+	 *  so overlapping areas are copied correctly. Rows are moved top-down or bottom-up, whichever never
+	 *  overwrites a source row before it has been read. If neither order is safe the area is copied via RAM.
+	 */
+	bool bltMove(Window srcWindow, SePos srcPos, Window dstWindow, SePos dstPos, SeSize size);
+
 	void scrollUp(Window window, unsigned lineCount, SeColor bgColor)
 	{
 		auto size = getWindowSize(window);
@@ -653,6 +746,47 @@ public:
 		bltSolidFill(window, SePos(0, size.height - lineCount), SeSize(size.width, lineCount), bgColor);
 	}
 
+	/* Asynchronous command queue */
+
+	using Fence = CommandQueue::Fence;
+
+	/** @brief Queue a solid fill operation
+	 *  @retval Fence Token to check for completion, 0 if the command was rejected
+	 *  @note Queued commands are executed in order via SPI completion callbacks so the caller never
+	 *  has to wait for the BLT engine. If the queue is full this call blocks until a slot is available.
+	 *  Direct (non-queued) drawing operations are not ordered with respect to the queue:
+	 *  call `flush()` first if this matters.
+	 */
+	Fence queueSolidFill(Window window, SePos pos, SeSize size, SeColor color);
+
+	/** @brief Queue a colour-expansion operation
+	 *  @note Source data at `srcAddr` must not be modified until the command has completed
+	 */
+	Fence queueMoveExpand(Window window, uint32_t srcAddr, SePos dstPos, SeSize dstSize, SeColor fgColor,
+						  SeColor bgColor);
+
+	Fence queueMove(Window window, BltCmd cmd, SePos srcPos, SePos dstPos, SeSize size);
+
+	/** @brief Queue a burst write to display memory
+	 *  @note Data is not copied so must remain valid until the command has completed
+	 */
+	Fence queueWrite(uint32_t address, const void* data, uint16_t length);
+
+	/** @brief Determine whether a queued command, and all those before it, have completed */
+	bool isComplete(Fence fence) const
+	{
+		return queue.isComplete(fence);
+	}
+
+	/** @brief Wait for a queued command to complete */
+	void waitFence(Fence fence);
+
+	/** @brief Wait for all queued commands to complete */
+	void flush()
+	{
+		waitFence(queue.getLastFence());
+	}
+
 	/** @brief Poll a display register and wait for a specific value, or until timeout
 	 * @note
 	 *
@@ -685,6 +819,89 @@ public:
 		return timing;
 	}
 
+	/** @brief Access the BLT completion model for tuning and statistics */
+	BltScheduler& getBltScheduler()
+	{
+		return bltScheduler;
+	}
+
+	/** @brief Get current display scan line
+	 *  @retval uint16_t Lines from 0 to (displayLines - 1) are visible, the remainder fall within vertical non-display
+	 */
+	uint16_t getScanLine();
+
+	/** @brief Wait until the display is in vertical non-display period
+	 *  @retval bool false if the period wasn't detected within one frame interval
+	 */
+	bool waitVerticalNonDisplay();
+
+	/* Page flipping */
+
+	/** @brief Allocate a second page for the main window so drawing is not visible until flip() is called
+	 *  @param copyFront true to initialise the new page with the currently displayed image
+	 *  @retval bool false if there is insufficient free VRAM, in which case drawing continues to the displayed page
+	 *  @note While active, getSurface(), getStartAddress(), etc. refer to the back (drawing) page
+	 */
+	bool beginDoubleBuffer(bool copyFront = true);
+
+	/** @brief Release the back page; the currently displayed page remains in use */
+	void endDoubleBuffer();
+
+	bool isDoubleBuffered() const
+	{
+		return backPage != VramHeap::invalid;
+	}
+
+	/** @brief Display the back page during vertical non-display period
+	 *  @param preserve true to copy the newly displayed image into the new back page
+	 *  @retval bool false if double-buffering is not active
+	 */
+	bool flip(bool preserve = false);
+
+	/* Raster synchronisation */
+
+	/** @brief Enable delaying of drawing operations until the display scan has passed the affected area
+	 *  @note Applies to direct BLT operations, drawFilledRectSlow() and drawImage(), but not queued commands.
+	 *  Drawing to a back page (see beginDoubleBuffer()) is never delayed.
+	 */
+	void setRasterSync(bool enable)
+	{
+		rasterSync = enable;
+	}
+
+	bool isRasterSync() const
+	{
+		return rasterSync;
+	}
+
+	RasterScheduler& getRasterScheduler()
+	{
+		return rasterScheduler;
+	}
+
+	/** @brief Wait until an area of a window may be updated without tearing
+	 *  @param duration Expected time for the update, in microseconds
+	 *  @note Returns immediately unless enabled via setRasterSync()
+	 */
+	void rasterWait(Window window, SePos pos, SeSize size, uint32_t duration);
+
+	/** @brief Estimate time to write data to the display, excluding setup overhead
+	 *  @retval uint32_t Time in microseconds
+	 */
+	uint32_t getTransferTime(uint32_t byteCount) const
+	{
+		uint32_t mhz = spiClock / 1000000U;
+		return (mhz == 0) ? 0 : byteCount * 8 / mhz;
+	}
+
+	/** @brief Access the display memory allocator
+	 *  @note The main and PIP window images are reserved by begin()
+	 */
+	VramHeap& getVram()
+	{
+		return vram;
+	}
+
 	/** @brief Calculate display time for the given number of frames
 	 *  @param frameCount
 	 *  @retval uint32_t time in milliseconds
@@ -723,6 +940,26 @@ public:
 	void prepareWrite(HSPI::Request& req, uint32_t address) override;
 	void prepareRead(HSPI::Request& req, uint32_t address) override;
 
+protected:
+	bool bltPrepareSolidFill(SeBltParam& blt, Window window, SePos pos, SeSize size, SeColor color);
+	bool bltPrepareMoveExpand(SeBltParam& blt, Window window, uint32_t srcAddr, SePos dstPos, SeSize dstSize,
+							  SeColor fgColor, SeColor bgColor);
+	bool bltPrepareMove(SeBltParam& blt, Window window, BltCmd cmd, SePos srcPos, SePos dstPos, SeSize size);
+
+	/** @brief Start a BLT operation
+	 *  @param blt Parameters for the operation
+	 *  @param window Destination window, used for raster synchronisation
+	 *  @param previous Parameters of the immediately preceding operation, if known.
+	 *  BLT registers retain their values so only those which differ need be sent.
+	 */
+	void bltExecute(const SeBltParam& blt, Window window = Window::invalid, const SeBltParam* previous = nullptr);
+
+	// Small writes can be handle asynchronously
+	HSPI::Request reqWr;
+
+	// Reads which may be overlapped with other work
+	HSPI::Request reqRd;
+
 private:
 	/** @brief Private method to initialize the S1D13781 registers
 	 *
@@ -742,13 +979,55 @@ private:
 
 	bool regReadWindow(Window window, uint16_t& value);
 
-	// Member data
+	/** @brief Re-calculate cached drawing parameters from registers */
+	void updateSurface(Window window);
 
-	// Small writes can be handle asynchronously
-	HSPI::Request reqWr;
+	/** @brief Mark surfaces affected by a register change as out of date */
+	void invalidateSurfaces(uint8_t regIndex);
 
-	uint16_t* cache{nullptr}; ///< Register cache
+	void bltCopyPage(uint32_t srcAddr, uint32_t dstAddr);
+
+	/** @brief Copy an area between windows by reading all of it into RAM, then writing it out */
+	bool moveBuffered(Window srcWindow, SePos srcPos, Window dstWindow, SePos dstPos, SeSize size);
+	bool bltWaitIdle(bool usePrediction);
+
+	Fence queueBlt(const SeBltParam& blt);
+	Command& queueReserve();
+	void serviceQueue();
+	static void queueTask(void* param);
+	static void queueDeferredTask(void* param);
+	static bool queueRequestComplete(HSPI::Request& request);
+
+	// Member data
+
+	// Command queue
+	enum class QueueState : uint8_t {
+		idle,	  ///< Ready to start next command
+		bltPoll,   ///< Reading BLT status
+		bltParams, ///< Writing BLT parameters
+		bltStart,  ///< Starting BLT operation
+		write,	 ///< Writing data
+	};
+	CommandQueue queue;
+	HSPI::Request reqQueue;
+	QueueState queueState{QueueState::idle};
+	uint16_t queueValue{0}; ///< Register value for status read / start write
+	bool queueDeferred{false}; ///< Waiting for predicted BLT completion
+
+	ShadowRegisters* shadow{nullptr}; ///< Register cache
+	uint8_t updateLevel{0};			  ///< Nesting level for beginUpdate() / endUpdate()
 	S1DTiming timing;
+	BltScheduler bltScheduler;
+	RasterScheduler rasterScheduler;
+	uint32_t spiClock{0};
+	bool rasterSync{false};
+
+	VramHeap vram;
+	VramHeap::Address frontPage{VramHeap::invalid}; ///< Page being displayed when double-buffered
+	VramHeap::Address backPage{VramHeap::invalid};  ///< Page being drawn
+	Surface surfaces[2];		 ///< Indexed by Window
+	uint8_t surfaceValid{0};	 ///< Bitmask of up-to-date surfaces
+	static const Surface invalidSurface;
 };
 
 } // namespace S1D13781
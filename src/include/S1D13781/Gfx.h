@@ -19,87 +19,54 @@
 
 #include "SeFont.h"
 #include "Driver.h"
+#include "GlyphAtlas.h"
+#include "SeRect.h"
+#include "DamageTracker.h"
 #include "SeColor.h"
+#include "Image.h"
 #include <algorithm>
 
 #define S1D13781_SHIELD_SWVERSION "S1D13781 Shield Graphics Library V1.0.2"
 #define S1D13781_SHIELD_SWRELDATE "Nov 6, 2015"
 
-namespace S1D13781
-{
-struct SeRect {
-	int16_t x = 0;
-	int16_t y = 0;
-	uint16_t width = 0;
-	uint16_t height = 0;
-
-	SeRect()
-	{
-	}
-
-	SeRect(int16_t x, int16_t y, uint16_t w, uint16_t h) : x(x), y(y), width(w), height(h)
-	{
-	}
-
-	SeRect(const SePos& pos, const SeSize& size) : x(pos.x), y(pos.y), width(size.width), height(size.height)
-	{
-	}
-
-	SeRect(const SeSize& size) : x(0), y(0), width(size.width), height(size.height)
-	{
-	}
-
-	SePos getPos() const
-	{
-		return SePos(x, y);
-	}
+/**
+ * @brief Maximum number of nested clip rectangles
+ */
+#ifndef S1D13781_CLIP_DEPTH
+#define S1D13781_CLIP_DEPTH 8
+#endif
 
-	SeSize getSize() const
-	{
-		return SeSize(width, height);
-	}
+/**
+ * @brief Polygons with up to this many edges are filled without using the heap
+ */
+#ifndef S1D13781_POLYGON_EDGES
+#define S1D13781_POLYGON_EDGES 8
+#endif
 
-	/** @brief bounding x coordinate outside rectangle */
-	int16_t x2() const
-	{
-		return x + int16_t(width);
-	}
+/**
+ * @brief Maximum number of polygon spans held back for combining with following scanlines
+ */
+#ifndef S1D13781_POLYGON_SPANS
+#define S1D13781_POLYGON_SPANS 4
+#endif
 
-	/** @brief bounding y coordinate outside rectangle */
-	int16_t y2() const
-	{
-		return y + int16_t(height);
-	}
+/**
+ * @brief Shortest run of identical pixels in a compressed image drawn with a solid fill BLT, in bytes
+ */
+#ifndef S1D13781_IMAGE_RUN_FILL
+#define S1D13781_IMAGE_RUN_FILL 64
+#endif
 
-	/** @brief Intersect self with another rectangle
-	 *  @param r
-	 *  @retval bool true if rectangles overlap
-	 */
-	bool intersect(const SeRect& r)
-	{
-		int16_t xo = std::max(x, r.x);
-		int16_t yo = std::max(y, r.y);
-		uint16_t wo = std::min(x2(), r.x2()) - xo;
-		uint16_t ho = std::min(y2(), r.y2()) - yo;
-
-		if(wo < 0 || ho < 0) {
-			width = 0;
-			height = 0;
-			return false;
-		} else {
-			x = xo;
-			y = yo;
-			width = wo;
-			height = ho;
-			return true;
-		}
-	}
+/**
+ * @brief Estimated fixed cost of an SPI transaction in microseconds, used to choose between drawing methods
+ */
+#ifndef S1D13781_SPI_SETUP_TIME
+#define S1D13781_SPI_SETUP_TIME 5
+#endif
 
-	bool overlap(const SeRect& r) const
-	{
-		return x < r.x2() && r.x < x2() && y < r.y2() && r.y < y2();
-	}
-};
+namespace S1D13781
+{
+class PixelBatcher;
 
 //possible sample patterns
 enum PatternType {
@@ -108,16 +75,55 @@ enum PatternType {
 	patternVertBars,
 };
 
-enum IntersectType {
-	noIntersect,
-	collinear,
-	intersect,
+/** @brief Direction in which a gradient changes colour */
+enum class GradientDirection {
+	vertical,   ///< Top to bottom, each row is a single colour
+	horizontal, ///< Left to right, each column is a single colour
+	diagonal,   ///< Top-left to bottom-right
 };
 
-// Graphics library functions
+/** @brief Graphics library functions
+ *
+ * Functions which need working buffers, such as copyArea() and fillGradient(), return 0 on success,
+ * 1 for an invalid window, 2 if a buffer cannot be allocated and 3 for invalid arguments or data.
+ */
 class Gfx : public Driver
 {
 public:
+	/** @brief Image drawing throughput */
+	struct ImageStats {
+		uint32_t count;		///< Number of images drawn
+		uint32_t bytes;		///< Bytes written to display memory
+		uint32_t time;		///< Total drawing time, in microseconds
+		uint32_t transferTime; ///< Time the writes would take at the SPI clock rate, in microseconds
+		uint32_t sourceBytes;  ///< Image data read from flash
+		uint32_t imageBytes;   ///< Size of the image data uncompressed
+		uint32_t savedBytes;   ///< SPI traffic avoided by drawing runs with solid fills
+
+		/** @brief Size of the source data as a percentage of its uncompressed size */
+		uint8_t getCompressionRatio() const
+		{
+			return (imageBytes == 0) ? 0 : uint64_t(sourceBytes) * 100 / imageBytes;
+		}
+
+		/** @brief Achieved throughput in kilobytes per second (divide by 1000 for MB/s) */
+		uint32_t getRate() const
+		{
+			return (time == 0) ? 0 : uint64_t(bytes) * 1000 / time;
+		}
+
+		/** @brief Achieved throughput as a percentage of the SPI clock rate */
+		uint8_t getEfficiency() const
+		{
+			return (time == 0) ? 0 : uint64_t(transferTime) * 100 / time;
+		}
+
+		void clear()
+		{
+			*this = ImageStats{};
+		}
+	};
+
 	using Driver::Driver;
 
 	/** @brief Fill the destination window with a specified color.
@@ -153,10 +159,9 @@ public:
 	 *
 	 * param	color	Color value as specified above.
 	 *
-	 * param	update_params	Determines whether draw_pixel will use the
-	 * 					"cached" parameters for this pixel draw. If in doubt,
-	 * 					set true to update the values (slower but no
-	 * 					potential for problems)
+	 * param	update_params	No longer required as window parameters are
+	 * 					maintained by the driver (see Driver::getSurface()).
+	 * 					Retained for compatibility.
 	 *
 	 * return
 	 * - Zero (0) indicates no errors.
@@ -212,6 +217,23 @@ public:
 	 */
 	uint16_t drawLine(Window window, int x1, int y1, int x2, int y2, SeColor color);
 
+	/** @brief Set the width of lines drawn by drawLine() and drawRect()
+	 *  @note
+	 * Lines are centred on their end points. Rectangle outlines are drawn inside the given area.
+	 * Thick lines are built from solid fill BLTs, one per horizontal or vertical run of the line.
+	 *
+	 * param	width	Line width in pixels, default 1
+	 */
+	void setLineWidth(uint8_t width)
+	{
+		lineWidth = std::max(width, uint8_t(1));
+	}
+
+	uint8_t getLineWidth() const
+	{
+		return lineWidth;
+	}
+
 	/** @brief Draw a rectangle of a specified width,height starting at pixel coordinate x,y using the specified color.
 	 *
 	 * param	window	Destination window for the rectangle.
@@ -262,13 +284,140 @@ public:
 	 */
 	uint16_t drawFilledRect(Window window, int xStart, int yStart, int width, int height, SeColor color)
 	{
-		return bltSolidFill(window, SePos(xStart, yStart), SeSize(width, height), color) ? 0 : 2;
+		return drawFilledRect(window, SeRect(xStart, yStart, width, height), color);
 	}
-	uint16_t drawFilledRect(Window window, const SeRect& rect, SeColor color)
+	uint16_t drawFilledRect(Window window, const SeRect& rect, SeColor color);
+
+	/** @brief Fill a list of rectangles
+	 *
+	 * param	window	Destination window
+	 * param	rects	Rectangles to fill
+	 * param	count	Number of rectangles
+	 * param	color	Fill colour for all rectangles
+	 *
+	 * return
+	 * - Zero (0) indicates no errors.
+	 * - 1 indicates invalid window error.
+	 *
+	 * @note
+	 * This is faster than calling drawFilledRect() repeatedly. The window parameters, clip rectangle and
+	 * colour are resolved once, and only the BLT registers which change from one rectangle to the next
+	 * (normally just the destination address and size) are sent.
+	 */
+	uint16_t fillRects(Window window, const SeRect* rects, unsigned count, SeColor color)
 	{
-		return bltSolidFill(window, rect.getPos(), rect.getSize(), color) ? 0 : 2;
+		return _fillRects(window, rects, nullptr, count, color);
 	}
 
+	/** @brief Fill a list of rectangles, each with its own colour
+	 *
+	 * param	colors	One colour per rectangle
+	 */
+	uint16_t fillRects(Window window, const SeRect* rects, const SeColor* colors, unsigned count)
+	{
+		return _fillRects(window, rects, colors, count, SeColor());
+	}
+
+	/** @brief Fill a rectangle with a linear gradient
+	 *
+	 * param	window		Destination window
+	 * param	rect		Area to fill, clipped to the window and current clip rectangle
+	 * param	from		Colour at the top and/or left edge
+	 * param	to			Colour at the bottom and/or right edge
+	 * param	direction	Direction of colour change
+	 *
+	 * return
+	 * - Zero (0) indicates no errors.
+	 * - 1 indicates invalid window error.
+	 * - 2 indicates memory allocation error.
+	 * - 3 indicates invalid direction.
+	 *
+	 * @note
+	 * The drawing method is chosen by estimating its cost from the SPI clock and BLT engine model:
+	 * - Vertical gradients use one solid fill per band of rows which share a colour in the window format,
+	 *   or a burst write per row for very narrow areas.
+	 * - Horizontal gradients use one solid fill per band of columns, or a single row is written and then
+	 *   replicated by BLT moves which double the filled area each time.
+	 * - Diagonal gradients write each row from a single pre-computed strip of pixels.
+	 */
+	uint16_t fillGradient(Window window, const SeRect& rect, SeColor from, SeColor to, GradientDirection direction);
+
+	/** @brief Draw a filled circle
+	 *
+	 * param	window	Destination window
+	 * param	x,y		Centre of the circle
+	 * param	radius	Radius in pixels; the circle is 2 * radius + 1 pixels across
+	 * param	color	Fill colour
+	 *
+	 * return
+	 * - Zero (0) indicates no errors.
+	 * - 1 indicates invalid window error.
+	 *
+	 * @note Curved shapes are filled as horizontal spans. Rows of equal width are combined and drawn
+	 * using solid fill BLTs, with matching spans above and below the centre drawn one after the other.
+	 */
+	uint16_t fillCircle(Window window, int x, int y, unsigned radius, SeColor color);
+
+	/** @brief Draw a one-pixel circle outline, see fillCircle() */
+	uint16_t drawCircle(Window window, int x, int y, unsigned radius, SeColor color);
+
+	/** @brief Draw a filled ellipse
+	 *
+	 * param	x,y		Centre of the ellipse
+	 * param	rx		Horizontal radius
+	 * param	ry		Vertical radius
+	 */
+	uint16_t fillEllipse(Window window, int x, int y, unsigned rx, unsigned ry, SeColor color);
+
+	/** @brief Draw a one-pixel ellipse outline, see fillEllipse() */
+	uint16_t drawEllipse(Window window, int x, int y, unsigned rx, unsigned ry, SeColor color);
+
+	/** @brief Draw a filled rectangle with rounded corners
+	 *
+	 * param	rect	Bounding rectangle
+	 * param	radius	Corner radius, limited to fit within the rectangle
+	 */
+	uint16_t fillRoundRect(Window window, const SeRect& rect, unsigned radius, SeColor color);
+
+	/** @brief Draw a one-pixel outline of a rectangle with rounded corners, see fillRoundRect() */
+	uint16_t drawRoundRect(Window window, const SeRect& rect, unsigned radius, SeColor color);
+
+	/** @brief Draw a filled triangle
+	 *
+	 * param	window		Destination window
+	 * param	x1,y1...	Vertices
+	 * param	color		Fill colour
+	 *
+	 * return
+	 * - Zero (0) indicates no errors.
+	 * - 1 indicates invalid window error.
+	 *
+	 * @note See fillPolygon()
+	 */
+	uint16_t fillTriangle(Window window, int x1, int y1, int x2, int y2, int x3, int y3, SeColor color);
+
+	/** @brief Draw a filled polygon
+	 *
+	 * param	window	Destination window
+	 * param	points	Vertices, the last is joined to the first
+	 * param	count	Number of vertices
+	 * param	color	Fill colour
+	 *
+	 * return
+	 * - Zero (0) indicates no errors.
+	 * - 1 indicates invalid window error.
+	 * - 2 indicates memory allocation error.
+	 *
+	 * @note
+	 * A pixel is filled if its centre lies inside the polygon, using the even-odd rule, with vertices on
+	 * pixel corners. So the polygon (x, y), (x + w, y), (x + w, y + h), (x, y + h) fills the same pixels as
+	 * drawFilledRect(x, y, w, h), and adjacent polygons sharing an edge don't overlap.
+	 *
+	 * Each scanline is converted to spans, and spans which keep the same extent over several scanlines
+	 * are combined into a single solid fill BLT.
+	 */
+	uint16_t fillPolygon(Window window, const SePos* points, unsigned count, SeColor color);
+
 	/** @brief Draw a filled rectangle of a specified width,height
 	 * starting at pixel coordinate x,y using the specified color. This
 	 * function uses the slower line buffer method (instead of BitBLT)
@@ -325,6 +474,83 @@ public:
 	 */
 	uint16_t drawPattern(Window window, PatternType pattern, uint8_t intensity);
 
+	/** @brief Restrict drawing to an area of the window
+	 *  @note
+	 * The new rectangle is intersected with the current one, so nested areas (such as a panel within a dialog)
+	 * cannot draw outside their parents. Each primitive is intersected with the clip rectangle once, before
+	 * any data is sent to the display. The same clip rectangle applies to all windows.
+	 *
+	 * param	rect	Area in window coordinates
+	 *
+	 * return	bool false if too many clip rectangles are in use (see S1D13781_CLIP_DEPTH)
+	 */
+	bool pushClip(const SeRect& rect);
+
+	/** @brief Restore the clip rectangle in effect before the last call to pushClip() */
+	void popClip();
+
+	/** @brief Remove all clip rectangles */
+	void resetClip()
+	{
+		clipDepth = 0;
+	}
+
+	/** @brief Get the area of a window to which drawing is currently restricted */
+	SeRect getClip(Window window);
+
+	/** @brief Keep font glyphs in display memory for use by drawText()
+	 *  @note
+	 * Once a glyph has been uploaded, drawing it needs only a colour-expansion BLT.
+	 * Text which is vertically clipped, or contains glyphs larger than maxWidth x maxHeight,
+	 * is drawn without using the cache.
+	 *
+	 * param	maxWidth	Largest glyph width to cache, up to 32 pixels
+	 * param	maxHeight	Largest glyph height to cache
+	 * param	slotCount	Number of glyphs to hold
+	 *
+	 * return	bool false if there is insufficient free VRAM
+	 */
+	bool beginGlyphCache(uint8_t maxWidth, uint8_t maxHeight, uint16_t slotCount)
+	{
+		return glyphAtlas.begin(maxWidth, maxHeight, slotCount);
+	}
+
+	void endGlyphCache()
+	{
+		glyphAtlas.end();
+	}
+
+	GlyphAtlas& getGlyphAtlas()
+	{
+		return glyphAtlas;
+	}
+
+	/** @brief Record areas of a window modified by drawing operations
+	 *  @note
+	 * Primitives report their bounding rectangles to the damage tracker, which the application may
+	 * use to redraw only what has changed. Rectangles may also be added directly via getDamage().
+	 *
+	 * param	window	Window to track, or Window::invalid to disable tracking
+	 */
+	void setDamageTracking(Window window);
+
+	DamageTracker& getDamage()
+	{
+		return damage;
+	}
+
+	/** @brief Discard the damage list at the end of a frame, updating statistics */
+	void clearDamage();
+
+	/** @brief Write damaged areas of a RAM copy of the tracked window to VRAM, then clear the damage list
+	 *
+	 * param	shadow			Image data in the format of the window, with the same dimensions
+	 * param	shadowStride	Bytes per row of shadow image
+	 *
+	 * return	uint32_t Number of bytes written
+	 */
+	uint32_t flushDamage(const void* shadow, unsigned shadowStride);
+
 	/** @brief Draw text containing "Chars" to the specified window using the given font.
 	 *
 	 * param	window		Destination window where the text is drawn.
@@ -458,9 +684,56 @@ public:
 	 *  @param y
 	 *  @param imageWidth
 	 *  @param imageHeight
+	 *  @param xScale Number of times each pixel is repeated horizontally
+	 *  @param yScale Number of times each row is repeated vertically
+	 *  @note Rows are converted into two alternating buffers and written asynchronously,
+	 *  so reading and converting each row overlaps with the SPI transfer of the previous one.
+	 *
+	 *  When scaling, pixels are repeated in the row buffer and each row is sent over SPI only once.
+	 *  The remaining copies of the row are made in display memory using BLT moves (see _replicateRow()).
 	 */
 	void drawImage(const FSTR::ObjectBase& image, Window window, int x, int y, unsigned imageWidth,
-				   unsigned imageHeight);
+				   unsigned imageHeight, uint8_t xScale = 1, uint8_t yScale = 1);
+
+	/** @brief Draw an image created by tools/mkimage.py
+	 *  @param image Header and pixel data, stored in flash memory
+	 *  @param window
+	 *  @param x
+	 *  @param y
+	 *  @param scale Integer magnification, applied in both directions as for the raw drawImage()
+	 *  @retval uint16_t 0 on success, 1 for invalid window, 2 if out of memory, 3 for invalid image
+	 *  @note Images already in the window format (or the LUT equivalent, which has the same layout)
+	 *  are copied from flash to display memory a row at a time with no conversion.
+	 *  Otherwise each row is converted using convertPixels().
+	 *
+	 *  Compressed images are decoded as they are read. Runs of at least S1D13781_IMAGE_RUN_FILL bytes
+	 *  are drawn using solid fills, with runs spanning several rows filled as a single rectangle.
+	 *  Other pixels are collected and burst-written a row at a time.
+	 */
+	uint16_t drawImage(const FSTR::ObjectBase& image, Window window, int x, int y, uint8_t scale = 1);
+
+	const ImageStats& getImageStats() const
+	{
+		return imageStats;
+	}
+
+	void clearImageStats()
+	{
+		imageStats.clear();
+	}
+
+	/** @brief Fill a rectangle by repeating a raw RGB image
+	 *  @param window
+	 *  @param rect Area to fill. The tile is aligned to the top-left corner.
+	 *  @param tile The image data, stored in flash memory
+	 *  @param tileWidth
+	 *  @param tileHeight
+	 *  @retval uint16_t 0 on success, 1 for invalid window, 2 if out of memory
+	 *  @note One copy of the tile is written, then BLT moves double the filled area until the row is complete,
+	 *  and again until the rectangle is complete. SPI traffic depends on the tile size, not the rectangle.
+	 */
+	uint16_t fillPattern(Window window, const SeRect& rect, const FSTR::ObjectBase& tile, unsigned tileWidth,
+						 unsigned tileHeight);
 
 	//uint16_t drawImage();  //TODO add for future versions of library
 	//uint16_t copyArea(WindowDestination srcWindow, WindowDestination destWindow, S1D13781_gfx::seRect area, int destX, int destY);
@@ -487,15 +760,65 @@ public:
 	uint16_t copyArea(Window srcWindow, Window destWindow, SeRect area, int destX, int destY);
 
 private:
-	/** @brief Private Method used by the S1D13781 graphics library functions.
+	/** @brief Draw a diagonal line wider than one pixel
+	 *
+	 * param	color	Must already be in the window format
+	 */
+	void _drawThickLine(Window window, int x1, int y1, int x2, int y2, SeColor color);
+
+	/** @brief Draw a rectangle whose corners are quarter ellipses
+	 *
+	 * param	rect	Bounding rectangle
+	 * param	rx,ry	Corner radii
+	 * param	filled	false to draw a one-pixel outline
+	 */
+	uint16_t _drawRounded(Window window, const SeRect& rect, unsigned rx, unsigned ry, SeColor color, bool filled);
+
+	/** @brief Fill rectangles using either a single colour or a list of colours */
+	uint16_t _fillRects(Window window, const SeRect* rects, const SeColor* colors, unsigned count, SeColor color);
+
+	/** @brief Update image statistics after drawing
+	 *  @param byteCount Bytes sent to the display
+	 *  @param sourceBytes Bytes of image data read
+	 *  @param imageBytes Uncompressed size of the image data read
+	 *  @param startTime Value of micros() when drawing started
 	 */
-	IntersectType _getIntersectionPoint(int AX1, int AY1, int AX2, int AY2, int BX1, int BY1, int BX2, int BY2,
-										int* intersectX, int* intersectY);
+	void _imageDrawn(uint32_t byteCount, uint32_t sourceBytes, uint32_t imageBytes, uint32_t startTime);
 
-	/** @brief Private Method used by the S1D13781 graphics library functions.
+	/** @brief Copy the first row of an area to the rows below it
+	 *
+	 * The row must already have been written. BLT moves double the number of rows copied each time,
+	 * so an area of n rows takes log2(n) moves.
 	 */
-	bool _cropLine(int* X1, int* Y1, int* X2, int* Y2, int cropRegionX, int cropRegionY, int cropRegionWidth,
-				   int cropRegionHeight);
+	void _replicateRow(Window window, const SeRect& area);
+
+	/** @brief Decode and draw a run-length encoded image */
+	uint16_t _drawImageRle(const FSTR::ObjectBase& image, const ImageHeader& header, Window window, int x, int y,
+						   unsigned scale);
+
+	uint16_t _fillGradientRows(Window window, const SeRect& rect, const SeRect& r, SeColor from, SeColor to);
+	uint16_t _fillGradientColumns(Window window, const SeRect& rect, const SeRect& r, SeColor from, SeColor to);
+	uint16_t _fillGradientDiagonal(Window window, const SeRect& rect, const SeRect& r, SeColor from, SeColor to);
+
+	/** @brief Estimate time for a BLT operation, including register writes, in microseconds */
+	uint32_t _getBltCost(Window window, BltCmd cmd, SeSize size);
+
+	/** @brief Estimate time for a burst write, in microseconds */
+	uint32_t _getWriteCost(unsigned byteCount) const
+	{
+		return S1D13781_SPI_SETUP_TIME + getTransferTime(byteCount);
+	}
+
+	struct PolygonEdge;
+
+	/** @brief Fill a polygon given by a list of non-horizontal edges, which are re-ordered */
+	uint16_t _fillEdges(Window window, PolygonEdge* edges, unsigned count, SeColor color);
+
+	/** @brief Fill the visible part of a span, using pixel writes if it is small
+	 *
+	 * param	color	Must already be in the window format
+	 */
+	void _drawSpan(PixelBatcher& batcher, const SeRect& clip, Window window, SeRect span, SeColor color);
 
 	/** @brief Draw a pattern of solid horizontal RGB color bars. This
 	 *
@@ -533,6 +856,26 @@ private:
 	 */
 	void _drawVertBars(Window window, unsigned int intensity);
 
+	/** @brief Get VRAM address for text bitmap data
+	 *  @param size Number of bytes required
+	 *  @retval uint32_t Allocated from the VRAM heap, VramHeap::invalid if there is insufficient memory
+	 *  @note After a failure, allocation is not attempted again until more display memory becomes free
+	 */
+	uint32_t _getTextScratch(unsigned size);
+
+	void _addDamage(Window window, const SeRect& rect)
+	{
+		if(window == damageWindow) {
+			damage.add(rect);
+		}
+	}
+
+	/** @brief Draw text using glyphs from the atlas
+	 *  @retval bool false if text cannot be drawn this way
+	 */
+	bool _drawTextCached(Window window, const SeFont& font, const char* text, unsigned length, int X, int Y,
+						 SeColor fgColor, SeColor bgColor);
+
 	//void _copyImage
 
 	/** @brief Copy a rectangular area to another area without any format translation
@@ -570,10 +913,26 @@ private:
 	 * - Returns 0 if successful.
 	 * - Returns 1 if invalid window error.
 	 * - Returns 2 if line buffer memory allocation error.
-	 * - Returns 3 if drawPixel error.
+	 * - Returns 3 if invalid format error.
 	 *
+	 * @note
+	 * Each row is read in one transfer, converted in RAM using convertPixels() and burst-written.
+	 * The read of the next row is issued before the current row is converted, and writes are asynchronous,
+	 * so conversion overlaps with SPI transfers.
 	 */
 	uint16_t _copyRegion(Window srcWindow, Window destWindow, SeRect area, int16_t destX, int16_t destY);
+
+	VramHeap::Address textScratch{VramHeap::invalid};
+	uint16_t textScratchSize{0};
+	bool textScratchFailed{false};
+	uint32_t textScratchLargestFree{0}; ///< Largest free VRAM block when allocation failed
+	GlyphAtlas glyphAtlas{*this, getVram()};
+	DamageTracker damage;
+	Window damageWindow{Window::invalid};
+	ImageStats imageStats{};
+	uint8_t lineWidth{1};
+	SeRect clipStack[S1D13781_CLIP_DEPTH];
+	uint8_t clipDepth{0};
 };
 
 } // namespace S1D13781
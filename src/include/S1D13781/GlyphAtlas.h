@@ -0,0 +1,110 @@
+/*
+ * GlyphAtlas.h
+ *
+ * Cache of font glyphs in display memory for use as colour-expansion BLT sources
+ *
+ */
+
+#pragma once
+
+#include "VramHeap.h"
+#include "SeFont.h"
+
+namespace S1D13781
+{
+/** @brief Fixed-size slots in VRAM holding 1bpp glyph bitmaps, replaced on a least-recently-used basis
+ *
+ * Each glyph is stored packed (no row padding) exactly as required by the moveExpand BLT.
+ * Slots are identified by font and character code, so if a font is unloaded or re-loaded then
+ * call `invalidate()` for it.
+ */
+class GlyphAtlas
+{
+public:
+	static constexpr uint32_t invalid = VramHeap::invalid;
+
+	struct Stats {
+		uint32_t hits;		   ///< Glyph found in atlas
+		uint32_t misses;	   ///< Glyph had to be uploaded
+		uint32_t evictions;	///< Glyph replaced another
+		uint32_t uploadBytes; ///< Total bitmap data written
+
+		void clear()
+		{
+			*this = Stats{};
+		}
+	};
+
+	GlyphAtlas(HSPI::MemoryDevice& device, VramHeap& heap) : device(device), heap(heap)
+	{
+	}
+
+	~GlyphAtlas()
+	{
+		end();
+	}
+
+	/** @brief Allocate atlas memory
+	 *  @param maxWidth Largest glyph width to be cached, up to 32 pixels
+	 *  @param maxHeight Largest glyph height to be cached
+	 *  @param slotCount Number of glyphs to hold, at least 2
+	 *  @retval bool false if there is insufficient RAM or VRAM
+	 */
+	bool begin(uint8_t maxWidth, uint8_t maxHeight, uint16_t slotCount);
+
+	/** @brief Release atlas memory */
+	void end();
+
+	bool isActive() const
+	{
+		return slots != nullptr;
+	}
+
+	/** @brief Determine if a glyph of the given dimensions fits into an atlas slot */
+	bool canHold(unsigned width, unsigned height) const
+	{
+		return isActive() && width <= 32 && ((width * height) + 7) / 8 <= slotSize;
+	}
+
+	/** @brief Get VRAM address of a glyph bitmap, uploading it if required
+	 *  @param font
+	 *  @param ch Character code
+	 *  @param offset Glyph location, as returned from `font.getCharOffset(ch)`
+	 *  @param width Glyph width, as returned from `font.getCharWidth(ch)`
+	 *  @retval uint32_t invalid if the glyph cannot be cached
+	 */
+	uint32_t getGlyph(const SeFont& font, uint8_t ch, const SeCharOffset& offset, unsigned width);
+
+	/** @brief Discard cached glyphs
+	 *  @param font Only glyphs for this font, or all glyphs if nullptr
+	 */
+	void invalidate(const SeFont* font = nullptr);
+
+	const Stats& getStats() const
+	{
+		return stats;
+	}
+
+	void clearStats()
+	{
+		stats.clear();
+	}
+
+private:
+	struct Slot {
+		const SeFont* font;
+		uint32_t lastUse;
+		uint8_t ch;
+	};
+
+	HSPI::MemoryDevice& device;
+	VramHeap& heap;
+	Slot* slots{nullptr};
+	uint32_t baseAddress{invalid};
+	uint16_t slotSize{0};
+	uint16_t slotCount{0};
+	uint32_t useCounter{0};
+	Stats stats{};
+};
+
+} // namespace S1D13781
@@ -0,0 +1,63 @@
+/*
+ * Image.h
+ *
+ * Image data pre-converted to a display format
+ *
+ */
+
+#pragma once
+
+#include "SeColor.h"
+
+namespace S1D13781
+{
+/** @brief Header at the start of an image created by tools/mkimage.py
+ *  @note Followed by `height` rows of `stride` bytes, in display memory (little-endian) byte order.
+ *
+ * If `flagRle` is set the pixel data is run-length encoded as a sequence of packets, each starting
+ * with a control byte:
+ *
+ * - bit 7: set for a run (one pixel follows, to be repeated), clear for literal pixels
+ * - bit 6: set if the count continues into the following byte
+ * - bits 0-5: count - 1, or the upper 6 bits of it if bit 6 is set
+ *
+ * Pixels are taken in row order and packets may span rows.
+ */
+struct __attribute__((packed)) ImageHeader {
+	static constexpr uint32_t magicValue = 0x4d495345; ///< "ESIM"
+	static constexpr uint8_t flagRle = 0x01;
+	static constexpr uint8_t rleRun = 0x80;
+	static constexpr uint8_t rleLong = 0x40;
+
+	uint32_t magic;
+	uint8_t format; ///< ImageDataFormat
+	uint8_t flags;  ///< flagRle or 0
+	uint16_t width;
+	uint16_t height;
+	uint16_t stride; ///< Bytes per row
+
+	ImageDataFormat getFormat() const
+	{
+		return ImageDataFormat(format);
+	}
+
+	uint8_t getBytesPerPixel() const
+	{
+		return ::getBytesPerPixel(getFormat());
+	}
+
+	bool isValid() const
+	{
+		auto bpp = getBytesPerPixel();
+		return magic == magicValue && (flags & ~flagRle) == 0 && bpp != 0 && stride >= width * bpp;
+	}
+
+	bool isCompressed() const
+	{
+		return flags & flagRle;
+	}
+};
+
+static_assert(sizeof(ImageHeader) == 12, "ImageHeader must match tools/mkimage.py");
+
+} // namespace S1D13781
@@ -0,0 +1,87 @@
+/*
+ * PixelBatcher.h
+ *
+ * Combines individual pixel writes into larger transfers
+ *
+ */
+
+#pragma once
+
+#include "Driver.h"
+
+/**
+ * @brief Maximum number of pixels in a span
+ */
+#ifndef S1D13781_PIXEL_BATCH
+#define S1D13781_PIXEL_BATCH 64
+#endif
+
+/**
+ * @brief Shortest run of identical pixels drawn using a solid fill BLT
+ */
+#ifndef S1D13781_PIXEL_BATCH_FILL
+#define S1D13781_PIXEL_BATCH_FILL 16
+#endif
+
+namespace S1D13781
+{
+/** @brief Collects consecutive pixels on the same row or column into a single transfer
+ *
+ * A pixel is appended to the current span if it continues it to the right (a row) or downwards (a column).
+ * Otherwise, or when the span is full, the span is written out:
+ *
+ * - A run of identical pixels at least S1D13781_PIXEL_BATCH_FILL long is drawn with a solid fill BLT
+ * - Other rows are sent as a single burst write
+ * - Other columns are written a pixel at a time, as they are not contiguous in display memory
+ *
+ * Pixels outside the window are discarded. Colours must already be in the window format (see Driver::lookupColor()).
+ * Any outstanding span is written when the batcher is destroyed.
+ */
+class PixelBatcher
+{
+public:
+	PixelBatcher(Driver& driver, Window window) : driver(driver), window(window), surface(driver.getSurface(window))
+	{
+	}
+
+	~PixelBatcher()
+	{
+		flush();
+	}
+
+	bool isValid() const
+	{
+		return surface.isValid();
+	}
+
+	/** @brief Add a pixel to the batch
+	 *  @retval bool false if pixel lies outside the window
+	 */
+	bool setPixel(int x, int y, SeColor color);
+
+	/** @brief Write any outstanding span to the display */
+	void flush();
+
+private:
+	enum class Direction : uint8_t {
+		none,
+		row,
+		column,
+	};
+
+	bool extends(int x, int y);
+	SeColor getPixel(unsigned index) const;
+
+	Driver& driver;
+	Window window;
+	const Surface& surface;
+	int16_t spanX{0};
+	int16_t spanY{0};
+	uint16_t count{0};
+	Direction direction{Direction::none};
+	bool uniform{true};
+	SeColor spanColor;
+	uint8_t buffer[S1D13781_PIXEL_BATCH * 3];
+};
+
+} // namespace S1D13781
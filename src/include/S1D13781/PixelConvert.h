@@ -0,0 +1,32 @@
+/*
+ * PixelConvert.h
+ *
+ * Conversion of pixel data between display formats
+ *
+ */
+
+#pragma once
+
+#include "SeColor.h"
+
+namespace S1D13781
+{
+/** @brief Convert a row of pixels from one format to another
+ *  @param dst Output buffer, `count` pixels in `dstFormat`
+ *  @param dstFormat
+ *  @param src Input buffer, `count` pixels in `srcFormat`
+ *  @param srcFormat
+ *  @param count Number of pixels
+ *  @retval bool false if either format is invalid
+ *  @note Pixel data is little-endian, as stored in display memory.
+ *  LUT formats are treated as their direct-colour equivalents, consistent with Surface::lookupColor().
+ *  Buffers may be the same only if the formats are also the same.
+ */
+bool convertPixels(void* dst, ImageDataFormat dstFormat, const void* src, ImageDataFormat srcFormat, unsigned count);
+
+/** @brief Convert a row of 24-bit image pixels, stored as R, G, B
+ *  @note Raw image data is in this byte order, whereas display memory holds B, G, R
+ */
+bool convertImagePixels(void* dst, ImageDataFormat dstFormat, const void* src, unsigned count);
+
+} // namespace S1D13781
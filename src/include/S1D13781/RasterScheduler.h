@@ -0,0 +1,81 @@
+/*
+ * RasterScheduler.h
+ *
+ * Predicts when display memory may be updated without visible tearing
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace S1D13781
+{
+/** @brief Model of the display scan used to delay updates until the beam has passed
+ *
+ * An update to a range of display lines is tear-free if it completes before the scan reaches it,
+ * or if it starts after the scan has passed and completes before the scan returns in the next frame.
+ * Otherwise the update is delayed until the scan has passed the last affected line.
+ */
+class RasterScheduler
+{
+public:
+	struct Stats {
+		uint32_t checks;	   ///< Number of updates checked
+		uint32_t deferred;	 ///< Number of updates delayed
+		uint32_t deferredTime; ///< Total delay, in microseconds
+		uint32_t maxDeferral;  ///< Longest single delay, in microseconds
+
+		void clear()
+		{
+			*this = Stats{};
+		}
+	};
+
+	/** @brief Set display timing
+	 *  @param lineInterval Time per line in nanoseconds
+	 *  @param displayLines Number of visible lines
+	 *  @param totalLines Visible plus non-display lines
+	 */
+	void setTiming(uint32_t lineInterval, uint16_t displayLines, uint16_t totalLines)
+	{
+		this->lineInterval = lineInterval ?: 1;
+		this->displayLines = displayLines;
+		this->totalLines = totalLines;
+	}
+
+	/** @brief Calculate how long to wait before updating a range of lines
+	 *  @param line Current scan line
+	 *  @param first First display line affected
+	 *  @param last Last display line affected
+	 *  @param duration Expected time for the update, in microseconds
+	 *  @retval uint32_t Required delay in microseconds
+	 */
+	uint32_t getDelay(uint16_t line, uint16_t first, uint16_t last, uint32_t duration) const;
+
+	/** @brief Record an update check and any resulting delay */
+	void checked(uint32_t delay);
+
+	uint16_t getDisplayLines() const
+	{
+		return displayLines;
+	}
+
+	const Stats& getStats() const
+	{
+		return stats;
+	}
+
+	void clearStats()
+	{
+		stats.clear();
+	}
+
+private:
+	Stats stats{};
+	uint32_t lineInterval{1};
+	uint16_t displayLines{0};
+	uint16_t totalLines{0};
+};
+
+} // namespace S1D13781
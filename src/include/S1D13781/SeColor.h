@@ -240,6 +240,12 @@ enum ColorConstants {
 	aclTransparent = 0xFFFFFFFF, // Pixel is transparent
 };
 
+/** @brief Calculate x / 255 without a division, exact for x < 65535 */
+static __forceinline unsigned divide255(unsigned x)
+{
+	return (x + 1 + (x >> 8)) >> 8;
+}
+
 struct RGBColor {
 	union {
 		struct {
@@ -295,11 +301,11 @@ struct RGBColor {
 		switch(format) {
 		case format_RGB_565:
 		case format_RGB_565LUT:
-			tmp.code = ((r * 31 / 255) << 11) | ((g * 63 / 255) << 5) | (b * 31 / 255);
+			tmp.code = (divide255(r * 31) << 11) | (divide255(g * 63) << 5) | divide255(b * 31);
 			break;
 
 		case format_RGB_332LUT:
-			tmp.code = ((r * 7 / 255) << 5) | ((g * 7 / 255) << 2) | (b * 3 / 255);
+			tmp.code = (divide255(r * 7) << 5) | (divide255(g * 7) << 2) | divide255(b * 3);
 			break;
 
 		case format_RGB_888:
@@ -0,0 +1,131 @@
+/*
+ * SeRect.h
+ *
+ */
+
+#pragma once
+
+#include "Driver.h"
+#include <algorithm>
+
+namespace S1D13781
+{
+struct SeRect {
+	int16_t x = 0;
+	int16_t y = 0;
+	uint16_t width = 0;
+	uint16_t height = 0;
+
+	SeRect()
+	{
+	}
+
+	SeRect(int16_t x, int16_t y, uint16_t w, uint16_t h) : x(x), y(y), width(w), height(h)
+	{
+	}
+
+	SeRect(const SePos& pos, const SeSize& size) : x(pos.x), y(pos.y), width(size.width), height(size.height)
+	{
+	}
+
+	SeRect(const SeSize& size) : x(0), y(0), width(size.width), height(size.height)
+	{
+	}
+
+	SePos getPos() const
+	{
+		return SePos(x, y);
+	}
+
+	SeSize getSize() const
+	{
+		return SeSize(width, height);
+	}
+
+	/** @brief bounding x coordinate outside rectangle */
+	int16_t x2() const
+	{
+		return x + int16_t(width);
+	}
+
+	/** @brief bounding y coordinate outside rectangle */
+	int16_t y2() const
+	{
+		return y + int16_t(height);
+	}
+
+	bool isEmpty() const
+	{
+		return width == 0 || height == 0;
+	}
+
+	uint32_t area() const
+	{
+		return uint32_t(width) * height;
+	}
+
+	/** @brief Intersect self with another rectangle
+	 *  @param r
+	 *  @retval bool true if rectangles overlap
+	 */
+	bool intersect(const SeRect& r)
+	{
+		int16_t xo = std::max(x, r.x);
+		int16_t yo = std::max(y, r.y);
+		int wo = std::min(x2(), r.x2()) - xo;
+		int ho = std::min(y2(), r.y2()) - yo;
+
+		if(wo <= 0 || ho <= 0) {
+			width = 0;
+			height = 0;
+			return false;
+		} else {
+			x = xo;
+			y = yo;
+			width = wo;
+			height = ho;
+			return true;
+		}
+	}
+
+	bool overlap(const SeRect& r) const
+	{
+		return x < r.x2() && r.x < x2() && y < r.y2() && r.y < y2();
+	}
+
+	bool contains(int px, int py) const
+	{
+		return px >= x && py >= y && px < x2() && py < y2();
+	}
+
+	/** @brief Determine if another rectangle lies entirely within this one */
+	bool contains(const SeRect& r) const
+	{
+		return r.x >= x && r.y >= y && r.x2() <= x2() && r.y2() <= y2();
+	}
+
+	/** @brief Get bounding rectangle of self and another rectangle */
+	SeRect united(const SeRect& r) const
+	{
+		if(isEmpty()) {
+			return r;
+		}
+		if(r.isEmpty()) {
+			return *this;
+		}
+		int16_t xo = std::min(x, r.x);
+		int16_t yo = std::min(y, r.y);
+		return SeRect(xo, yo, std::max(x2(), r.x2()) - xo, std::max(y2(), r.y2()) - yo);
+	}
+};
+
+/** @brief Clip a line to a rectangle
+ *  @param x1,y1,x2,y2 End points of the line, updated to lie within the rectangle
+ *  @param clip The clipping rectangle
+ *  @retval bool false if no part of the line lies within the rectangle
+ *  @note Uses Cohen-Sutherland with integer arithmetic, so lines entirely to one side are rejected without
+ *  calculating any intersections. Clipped end points are rounded to the nearest pixel.
+ */
+bool clipLine(int& x1, int& y1, int& x2, int& y2, const SeRect& clip);
+
+} // namespace S1D13781
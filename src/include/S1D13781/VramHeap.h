@@ -0,0 +1,113 @@
+/*
+ * VramHeap.h
+ *
+ * Allocator for display memory (VRAM)
+ *
+ */
+
+#pragma once
+
+#include <HSPI/MemoryDevice.h>
+
+#ifndef S1D13781_VRAM_HEAP_BLOCKS
+#define S1D13781_VRAM_HEAP_BLOCKS 32
+#endif
+
+namespace S1D13781
+{
+/** @brief Manages regions of display memory
+ *
+ * Bookkeeping is held entirely in RAM using a fixed table of blocks, sorted by address.
+ * Adjacent free blocks are merged when released.
+ *
+ * Each allocation is followed by a guard word written to VRAM. This is verified when the block is
+ * released, or on demand via `check()`, to detect writes (or BLTs) which overrun their region.
+ *
+ * Regions configured outside of the heap, such as the main framebuffer and PIP image, must be
+ * marked using `reserve()` so they're not handed out.
+ */
+class VramHeap
+{
+public:
+	using Address = uint32_t;
+
+	static constexpr Address invalid = 0xFFFFFFFF;
+	static constexpr unsigned maxBlocks = S1D13781_VRAM_HEAP_BLOCKS;
+	static constexpr unsigned guardSize = 4;
+	static constexpr uint32_t guardValue = 0xC33CA55A;
+
+	struct Stats {
+		uint32_t size;			 ///< Total managed memory
+		uint32_t used;			 ///< Bytes allocated or reserved, including alignment and guards
+		uint32_t free;			 ///< Bytes available
+		uint32_t largestFree;	///< Largest single allocation possible, ignoring alignment
+		uint16_t usedBlocks;	 ///< Number of allocated or reserved regions
+		uint16_t freeBlocks;	 ///< Number of separate free regions
+		uint16_t allocFailures;  ///< Number of failed alloc() or reserve() calls
+		uint16_t guardFailures;  ///< Number of corrupted guard words detected
+
+		/** @brief Proportion of free memory not available as a single block, in percent */
+		unsigned fragmentation() const
+		{
+			return (free == 0) ? 0 : 100 - (100ULL * largestFree / free);
+		}
+	};
+
+	VramHeap(HSPI::MemoryDevice& device) : device(device)
+	{
+	}
+
+	/** @brief Discard all allocations and reset to a single free region */
+	void initialise(uint32_t size);
+
+	/** @brief Mark a fixed region as in use
+	 *  @retval bool false if any part of the region is already in use
+	 *  @note Reserved regions have no guard word
+	 */
+	bool reserve(Address address, uint32_t size);
+
+	/** @brief Allocate a region of display memory
+	 *  @param size Required size in bytes
+	 *  @param alignment Must be a power of 2. Window start addresses require at least 4.
+	 *  @retval Address invalid if there is insufficient memory
+	 */
+	Address alloc(uint32_t size, unsigned alignment = 4);
+
+	/** @brief Release a previously allocated or reserved region
+	 *  @retval bool false if address is not the start of a used block
+	 */
+	bool free(Address address);
+
+	/** @brief Get the usable size of an allocated block
+	 *  @retval uint32_t 0 if address is not the start of a used block
+	 */
+	uint32_t getSize(Address address) const;
+
+	/** @brief Verify guard words of all allocated blocks
+	 *  @retval bool true if all guards are intact
+	 */
+	bool check();
+
+	Stats getStats() const;
+
+private:
+	struct Block {
+		Address address;
+		uint32_t size;
+		bool used;
+		bool guarded;
+	};
+
+	int find(Address address) const;
+	bool split(unsigned index, Address address, uint32_t size);
+	void merge(unsigned index);
+	bool checkGuard(const Block& block);
+
+	HSPI::MemoryDevice& device;
+	Block blocks[maxBlocks];
+	uint16_t blockCount{0};
+	uint16_t allocFailures{0};
+	uint16_t guardFailures{0};
+};
+
+} // namespace S1D13781
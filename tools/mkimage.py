@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+#
+# mkimage.py
+#
+# Convert an image into the S1D13781 image container format, ready for Gfx::drawImage().
+#
+# Pixel data is pre-converted to the window colour format so it can be written to display memory
+# without any conversion on the device.
+#
+# Usage:
+#   mkimage.py [--format rgb888|rgb565|rgb332] [--rle] input output
+#   mkimage.py [--format ...] [--rle] --size WIDTHxHEIGHT input.raw output
+#
+# Input is any image file readable by Pillow, or raw 24-bit data stored as R, G, B if --size is given.
+# With --rle the pixel data is run-length encoded, which suits images with large areas of flat colour.
+#
+
+import argparse
+import struct
+import sys
+
+# Must match ImageHeader in src/include/S1D13781/Image.h
+IMAGE_MAGIC = 0x4d495345  # "ESIM"
+HEADER_FORMAT = '<IBBHHH'
+FLAG_RLE = 0x01
+RLE_RUN = 0x80
+RLE_LONG = 0x40
+RLE_MAX_COUNT = 0x4000
+# Shorter runs are stored as literal pixels
+RLE_MIN_RUN = 3
+
+# ImageDataFormat values
+FORMATS = {
+    'rgb888': (0, 3),
+    'rgb565': (1, 2),
+    'rgb332': (6, 1),
+}
+
+
+def encode_pixel(r, g, b, fmt):
+    """Encode a pixel, rounding as RGBColor::getColor() does, in display memory (little-endian) byte order"""
+    if fmt == 'rgb565':
+        code = ((r * 31 // 255) << 11) | ((g * 63 // 255) << 5) | (b * 31 // 255)
+        return struct.pack('<H', code)
+    if fmt == 'rgb332':
+        code = ((r * 7 // 255) << 5) | ((g * 7 // 255) << 2) | (b * 3 // 255)
+        return struct.pack('<B', code)
+    return bytes((b, g, r))
+
+
+def rle_packet(kind, count):
+    """Control byte(s) for a packet of `count` pixels"""
+    count -= 1
+    if count < 0x40:
+        return bytes((kind | count,))
+    return bytes((kind | RLE_LONG | (count >> 8), count & 0xff))
+
+
+def rle_encode(pixels):
+    """Encode a list of pixels, each as bytes, into runs and literals"""
+    out = bytearray()
+    literal = []
+
+    def flush_literal():
+        while literal:
+            chunk = literal[:RLE_MAX_COUNT]
+            del literal[:RLE_MAX_COUNT]
+            out.extend(rle_packet(0, len(chunk)))
+            out.extend(b''.join(chunk))
+
+    i = 0
+    while i < len(pixels):
+        j = i + 1
+        while j < len(pixels) and j - i < RLE_MAX_COUNT and pixels[j] == pixels[i]:
+            j += 1
+        if j - i >= RLE_MIN_RUN:
+            flush_literal()
+            out.extend(rle_packet(RLE_RUN, j - i))
+            out.extend(pixels[i])
+        else:
+            literal.extend(pixels[i:j])
+        i = j
+    flush_literal()
+    return bytes(out)
+
+
+def load_raw(filename, size):
+    width, height = (int(n) for n in size.lower().split('x'))
+    with open(filename, 'rb') as f:
+        data = f.read()
+    if len(data) < width * height * 3:
+        sys.exit("'%s' is too small for %u x %u pixels" % (filename, width, height))
+    pixels = [tuple(data[i:i + 3]) for i in range(0, width * height * 3, 3)]
+    return width, height, pixels
+
+
+def load_image(filename):
+    try:
+        from PIL import Image
+    except ImportError:
+        sys.exit("Pillow is required to read image files, or use --size for raw RGB data")
+    img = Image.open(filename).convert('RGB')
+    return img.width, img.height, list(img.getdata())
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Create S1D13781 image file')
+    parser.add_argument('--format', choices=FORMATS.keys(), default='rgb565', help='Target colour format')
+    parser.add_argument('--size', help='Input is raw R, G, B data with the given dimensions, e.g. 320x240')
+    parser.add_argument('--rle', action='store_true', help='Run-length encode pixel data')
+    parser.add_argument('input', help='Source image')
+    parser.add_argument('output', help='Output file')
+    args = parser.parse_args()
+
+    if args.size:
+        width, height, pixels = load_raw(args.input, args.size)
+    else:
+        width, height, pixels = load_image(args.input)
+
+    format_code, bytes_per_pixel = FORMATS[args.format]
+    stride = width * bytes_per_pixel
+    encoded = [encode_pixel(r, g, b, args.format) for r, g, b in pixels]
+    if args.rle:
+        flags = FLAG_RLE
+        data = rle_encode(encoded)
+    else:
+        flags = 0
+        data = b''.join(encoded)
+
+    with open(args.output, 'wb') as f:
+        f.write(struct.pack(HEADER_FORMAT, IMAGE_MAGIC, format_code, flags, width, height, stride))
+        f.write(data)
+
+    print("%s: %u x %u, %s%s, %u bytes (%u%% of uncompressed)" %
+          (args.output, width, height, args.format, ', RLE' if args.rle else '', 12 + len(data),
+           100 * len(data) // (stride * height)))
+
+
+if __name__ == '__main__':
+    main()